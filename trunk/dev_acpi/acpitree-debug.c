@@ -70,42 +70,13 @@ dump(char *msg, unsigned char *buf, int size)
 #define dump(msg, buf, size)
 #endif
 
-/*
- * get type
- */
-acpi_object_type
-get_type(int fd, char *path)
-{
-	dev_acpi_t		data;
-	union acpi_object	obj;
-
-	memset(&data, 0, sizeof(data));
-
-	strcpy(data.pathname, path);
-
-	if (ioctl(fd, DEV_ACPI_GET_TYPE, &data))
-		return -1;
-
-	if (data.return_size != sizeof(obj))
-		return -1;
-
-	if (read(fd, &obj, data.return_size) != data.return_size)
-		return -1;
-
-	dump("get_type", (unsigned char *)&obj, data.return_size);
-	if (obj.type != ACPI_TYPE_INTEGER)
-		return -1;
-
-	return (acpi_object_type)obj.integer.value;
-}
-
 /*
  * Do we consider this path a file or directory?
  */
 int
-is_dev(int fd, char *path)
+is_dev(acpi_object_type type)
 {
-	switch (get_type(fd, path)) {
+	switch (type) {
 		case ACPI_TYPE_DEVICE:
 		case ACPI_TYPE_PROCESSOR:
 		case ACPI_TYPE_THERMAL:
@@ -500,77 +471,77 @@ get_parent(int fd, char *name, char **buf)
 }
 
 /*
- * Print out a "directory" and recurse through sub-dirs
+ * Get the objects below path along with their types, returns the
+ * number of dev_acpi_node_t records in *nodes or -1 on error
  */
-void
-print_level(int fd, char *path, int *entries, int level)
+int
+get_next_nodes(int fd, char *path, dev_acpi_node_t **nodes)
 {
 	dev_acpi_t	data;
-	int		i, cnt;
-	char		*buf, *tmp, *tmp2;
 
 	memset(&data, 0, sizeof(data));
-	
+	*nodes = NULL;
+
 	if (path)
 		strcpy(data.pathname, path);
 
-	if (ioctl(fd, DEV_ACPI_GET_NEXT, &data)) {
-		printf("GET_NEXT failed at %s (%s)\n", path, strerror(errno));
-		return;
-	}
+	if (ioctl(fd, DEV_ACPI_GET_NEXT_NODES, &data))
+		return -1;
 
-	buf = malloc(data.return_size);
+	if (data.return_size == 0)
+		return 0;
 
-	if (!buf) {
-		printf("failed to malloc get_next buffer at %s\n", path);
-		return;
-	}
+	*nodes = malloc(data.return_size);
 
-	if (data.return_size == 0)
-		return;
+	if (!*nodes)
+		return -1;
 
-	if (read(fd, buf, data.return_size) != data.return_size) {
-		printf("short read at %s\n", path);
-		return;
+	if (read(fd, *nodes, data.return_size) != data.return_size) {
+		free(*nodes);
+		*nodes = NULL;
+		return -1;
 	}
 
-	dump("GET_NEXT", buf, data.return_size);
-	// printf("BUFFER: %s\n", buf);
+	dump("GET_NEXT_NODES", (unsigned char *)*nodes, data.return_size);
+	return data.return_size / sizeof(dev_acpi_node_t);
+}
+
+/*
+ * Print out a "directory" and recurse through sub-dirs
+ */
+void
+print_level(int fd, char *path, int *entries, int level)
+{
+	dev_acpi_node_t	*nodes;
+	int		i, cnt, type;
 
-	tmp = buf;
-	for (cnt = 0; (tmp = strchr(tmp, '\n')) != NULL ; cnt++)
-		tmp++;
+	cnt = get_next_nodes(fd, path, &nodes);
+
+	if (cnt < 0) {
+		printf("GET_NEXT_NODES failed at %s (%s)\n", path,
+		       strerror(errno));
+		return;
+	}
 
 	entries[level] = cnt;
 	
-	tmp = buf;
 	for (i = 0 ; i < cnt ; i++) {
 		unsigned long len;
-		char *new_path, *cur_obj, hid[8];
+		char *new_path, cur_obj[5], hid[8];
 
-		tmp2 = strchr(tmp, '\n');
+		memset(cur_obj, 0, sizeof(cur_obj));
+		memcpy(cur_obj, nodes[i].name, sizeof(nodes[i].name));
 
-		len = (unsigned long)tmp2 - (unsigned long)tmp;
-		len++;
+		type = nodes[i].type;
 
-		cur_obj = malloc(len);
-
-		if (!cur_obj) {
-			free(buf);
-			return;
-		}
-		memset(cur_obj, 0, len);
-		strncpy(cur_obj, tmp, len - 1);
-
-		tmp = tmp2 + 1;
-		
+		len = sizeof(cur_obj);
 		if (path)
 			len += strlen(path) + 1;
 
 		new_path = malloc(len);
 
 		if (!new_path) {
-			free(buf);
+			free(nodes);
 			return;
 		}
 		memset(new_path, 0, len);
@@ -581,27 +552,29 @@ print_level(int fd, char *path, int *entries, int level)
 		}
 		strcat(new_path, cur_obj);
 		
-		if (is_dev(fd, new_path)) {
+		if (is_dev(type)) {
 			indent(entries, level);
-			printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
-			print_level(fd, new_path, entries, level + 1);
+			printf("%s [%d]\n", cur_obj, type);
+			if (nodes[i].children)
+				print_level(fd, new_path, entries,
+				            level + 1);
 		} else {
 			indent(entries, level);
 			if (!strcmp(cur_obj, "_HID") ||
 			    !strcmp(cur_obj, "_CID")) {
 				get_hid(fd, new_path, hid);
-				printf("%s (%s) [%d]\n", cur_obj, hid, get_type(fd, new_path));
+				printf("%s (%s) [%d]\n", cur_obj, hid, type);
 			} else if (!strcmp(cur_obj, "_STR") ||
-			           get_type(fd, new_path) == ACPI_TYPE_STRING) {
+			           type == ACPI_TYPE_STRING) {
 				char *str = NULL;
 				get_string(fd, new_path, &str);
-				printf("%s (%s) [%d]\n", cur_obj, str, get_type(fd, new_path));
+				printf("%s (%s) [%d]\n", cur_obj, str, type);
 				free(str);
 			} else if (!strcmp(cur_obj, "_STA") ||
-			           get_type(fd, new_path)==ACPI_TYPE_INTEGER) {
+			           type == ACPI_TYPE_INTEGER) {
 				printf("%s (0x%llx) [%d]\n", cur_obj,
 				       get_integer(fd, new_path),
-				       get_type(fd, new_path));
+				       type);
 			} else if (!strcmp(cur_obj, "_CRS") ||
 			           !strcmp(cur_obj, "_PRT") ||
 			           !strcmp(cur_obj, "_MAT")) {
@@ -611,9 +584,9 @@ print_level(int fd, char *path, int *entries, int level)
 				len = dump_raw(fd, new_path, &buf);
 
 				if (len <= 0)
-					printf("%s (empty/failed) [%d]\n", cur_obj, get_type(fd, new_path));
+					printf("%s (empty/failed) [%d]\n", cur_obj, type);
 				else {
-					printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
+					printf("%s [%d]\n", cur_obj, type);
 
 					indent(entries, level);
 					printf("\t%04x: ", 0);
@@ -629,13 +602,13 @@ print_level(int fd, char *path, int *entries, int level)
 					printf("\n");
 				}
 			} else
-				printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
+				printf("%s [%d]\n", cur_obj, type);
 		}
 
 		entries[level]--;
 		free(new_path);
-		free(cur_obj);
 	}
+	free(nodes);
 
 
 }
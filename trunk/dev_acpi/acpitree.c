@@ -28,6 +28,7 @@
 #include <fcntl.h>
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 
 #define ACPI_USE_SYSTEM_CLIBRARY
 #define ACPI_USE_STANDARD_HEADERS
@@ -55,8 +56,12 @@ typedef int64_t   s64;
 #include "dev_acpi.h"
 
 #define DEVICE "/dev/acpi"
+#define AREA_SIZE (64 * 1024)
 
-static char *acpi_type[0x20] =
+/* Result area mmap'd from the device, NULL if that's not supported */
+static u8 *area;
+
+static char *acpi_type[0x21] =
 {	"Any",
 	"Integer",
 	"String",
@@ -88,8 +93,11 @@ static char *acpi_type[0x20] =
 	"Local Extra",
 	"Local Data/Local Max",
 	"Invalid",
-	"Not Found" /* 0x1F */
+	"Not Found", /* 0x1F */
+	"Unknown" /* anything else, eg. ACPI_TYPE_NOT_FOUND */
 };
+
+#define ACPI_TYPE_UNKNOWN (sizeof(acpi_type) / sizeof(acpi_type[0]) - 1)
 	
 #ifdef DEBUG
 static void
@@ -112,42 +120,13 @@ dump(char *msg, unsigned char *buf, int size)
 #define dump(msg, buf, size)
 #endif
 
-/*
- * get type
- */
-acpi_object_type
-get_type(int fd, char *path)
-{
-	dev_acpi_t		data;
-	union acpi_object	obj;
-
-	memset(&data, 0, sizeof(data));
-
-	strcpy(data.pathname, path);
-
-	if (ioctl(fd, DEV_ACPI_GET_TYPE, &data))
-		return -1;
-
-	if (data.return_size != sizeof(obj))
-		return -1;
-
-	if (read(fd, &obj, data.return_size) != data.return_size)
-		return -1;
-
-	dump("get_type", (unsigned char *)&obj, data.return_size);
-	if (obj.type != ACPI_TYPE_INTEGER)
-		return -1;
-
-	return (acpi_object_type)obj.integer.value;
-}
-
 /*
  * Do we consider this path a file or directory?
  */
 int
-is_dev(int fd, char *path)
+is_dev(acpi_object_type type)
 {
-	switch (get_type(fd, path)) {
+	switch (type) {
 		case ACPI_TYPE_DEVICE:
 		case ACPI_TYPE_PROCESSOR:
 		case ACPI_TYPE_THERMAL:
@@ -356,6 +335,34 @@ get_integer(int fd, char *path)
 	return obj.integer.value;
 }
 
+/*
+ * Identification objects of a device in one ioctl, returns 0 on success
+ */
+int
+get_device_info(int fd, char *path, dev_acpi_device_info_t *info)
+{
+	dev_acpi_t	data;
+
+	memset(&data, 0, sizeof(data));
+	strcpy(data.pathname, path);
+
+	if (ioctl(fd, DEV_ACPI_GET_DEVICE_INFO, &data))
+		return -1;
+
+	if (data.return_size != sizeof(*info))
+		return -1;
+
+	if (read(fd, info, data.return_size) != data.return_size)
+		return -1;
+
+	return 0;
+}
+
+/*
+ * Evaluate path, *buf is the raw result.  It points into the mmap'd area
+ * if there is one (only valid until the next evaluation), otherwise it's
+ * malloc'd.
+ */
 int
 dump_raw(int fd, char *path, u8 **buf)
 {
@@ -365,6 +372,15 @@ dump_raw(int fd, char *path, u8 **buf)
 	memset(&data, 0, sizeof(data));
 	strcpy(data.pathname, path);
 
+	if (area) {
+		if (!ioctl(fd, DEV_ACPI_EVALUATE_MMAP, &data)) {
+			*buf = area;
+			return data.return_size;
+		}
+		if (errno != E2BIG)
+			return -1;
+	}
+
 	if (ioctl(fd, DEV_ACPI_EVALUATE_OBJ, &data)) {
 		return -1;
 	}
@@ -386,77 +402,87 @@ dump_raw(int fd, char *path, u8 **buf)
 }
 
 /*
- * Print out a "directory" and recurse through sub-dirs
+ * Get the objects below path along with their types, returns the
+ * number of dev_acpi_node_t records in *nodes or -1 on error
  */
-void
-print_level(int fd, char *path, int *entries, int level)
+int
+get_next_nodes(int fd, char *path, dev_acpi_node_t **nodes)
 {
 	dev_acpi_t	data;
-	int		i, cnt, tmp_type;
-	char		*buf, *tmp, *tmp2;
 
 	memset(&data, 0, sizeof(data));
-	
+	*nodes = NULL;
+
 	if (path)
 		strcpy(data.pathname, path);
 
-	if (ioctl(fd, DEV_ACPI_GET_NEXT, &data)) {
-		printf("GET_NEXT failed at %s (%s)\n", path, strerror(errno));
-		return;
-	}
+	if (ioctl(fd, DEV_ACPI_GET_NEXT_NODES, &data))
+		return -1;
 
-	buf = malloc(data.return_size);
+	if (data.return_size == 0)
+		return 0;
 
-	if (!buf) {
-		printf("failed to malloc get_next buffer at %s\n", path);
-		return;
-	}
+	*nodes = malloc(data.return_size);
 
-	if (data.return_size == 0)
-		return;
+	if (!*nodes)
+		return -1;
 
-	if (read(fd, buf, data.return_size) != data.return_size) {
-		printf("short read at %s\n", path);
-		return;
+	if (read(fd, *nodes, data.return_size) != data.return_size) {
+		free(*nodes);
+		*nodes = NULL;
+		return -1;
 	}
 
-	dump("GET_NEXT", buf, data.return_size);
-	// printf("BUFFER: %s\n", buf);
+	dump("GET_NEXT_NODES", (unsigned char *)*nodes, data.return_size);
+	return data.return_size / sizeof(dev_acpi_node_t);
+}
+
+/*
+ * Print out a "directory" and recurse through sub-dirs
+ */
+void
+print_level(int fd, char *path, int *entries, int level)
+{
+	dev_acpi_node_t		*nodes;
+	dev_acpi_device_info_t	info;
+	int			i, j, cnt, tmp_type, type;
+
+	cnt = get_next_nodes(fd, path, &nodes);
 
-	tmp = buf;
-	for (cnt = 0; (tmp = strchr(tmp, '\n')) != NULL ; cnt++)
-		tmp++;
+	if (cnt < 0) {
+		printf("GET_NEXT_NODES failed at %s (%s)\n", path,
+		       strerror(errno));
+		return;
+	}
 
 	entries[level] = cnt;
+
+	/* _HID, _CID, _UID, _ADR and _STA below come from here if valid */
+	memset(&info, 0, sizeof(info));
+	if (path && get_device_info(fd, path, &info))
+		info.valid = 0;
 	
-	tmp = buf;
 	for (i = 0 ; i < cnt ; i++) {
 		unsigned long len;
-		char *new_path, *cur_obj, hid[8];
+		char *new_path, cur_obj[5], hid[8];
 
-		tmp2 = strchr(tmp, '\n');
+		memset(cur_obj, 0, sizeof(cur_obj));
+		memcpy(cur_obj, nodes[i].name, sizeof(nodes[i].name));
 
-		len = (unsigned long)tmp2 - (unsigned long)tmp;
-		len++;
+		type = nodes[i].type;
 
-		cur_obj = malloc(len);
-
-		if (!cur_obj) {
-			free(buf);
-			return;
-		}
-		memset(cur_obj, 0, len);
-		strncpy(cur_obj, tmp, len - 1);
+		tmp_type = type;
+		if (tmp_type > ACPI_TYPE_UNKNOWN)
+			tmp_type = ACPI_TYPE_UNKNOWN;
 
-		tmp = tmp2 + 1;
-		
+		len = sizeof(cur_obj);
 		if (path)
 			len += strlen(path) + 1;
 
 		new_path = malloc(len);
 
 		if (!new_path) {
-			free(buf);
+			free(nodes);
 			return;
 		}
 		memset(new_path, 0, len);
@@ -467,36 +493,48 @@ print_level(int fd, char *path, int *entries, int level)
 		}
 		strcat(new_path, cur_obj);
 		
-		if (is_dev(fd, new_path)) {
+		if (is_dev(type)) {
 			indent(entries, level);
-			tmp_type = get_type(fd, new_path);
-			if (tmp_type == ACPI_TYPE_NOT_FOUND)
-				tmp_type = sizeof(acpi_type) - 1;
 			printf("%s [%s]\n", cur_obj, acpi_type[tmp_type]);
-			print_level(fd, new_path, entries, level + 1);
+			if (nodes[i].children)
+				print_level(fd, new_path, entries,
+				            level + 1);
 		} else {
 			indent(entries, level);
-			if (!strcmp(cur_obj, "_HID") ||
-			    !strcmp(cur_obj, "_CID")) {
+			if (!strcmp(cur_obj, "_HID") &&
+			    (info.valid & ACPI_VALID_HID)) {
+				printf("%s (%s) [%s]\n", cur_obj, info.hid, acpi_type[tmp_type]);
+			} else if (!strcmp(cur_obj, "_CID") &&
+			           (info.valid & ACPI_VALID_CID)) {
+				printf("%s (", cur_obj);
+				for (j = 0 ; j < info.cid_count &&
+				             j < DEV_ACPI_INFO_CIDS ; j++)
+					printf("%s%s", j ? "," : "",
+					       info.cid[j]);
+				printf(") [%s]\n", acpi_type[tmp_type]);
+			} else if (!strcmp(cur_obj, "_UID") &&
+			           (info.valid & ACPI_VALID_UID)) {
+				printf("%s (%s) [%s]\n", cur_obj, info.uid, acpi_type[tmp_type]);
+			} else if (!strcmp(cur_obj, "_STA") &&
+			           (info.valid & ACPI_VALID_STA)) {
+				printf("%s (0x%x) [%s]\n", cur_obj, info.sta, acpi_type[tmp_type]);
+			} else if (!strcmp(cur_obj, "_ADR") &&
+			           (info.valid & ACPI_VALID_ADR)) {
+				printf("%s (0x%llx) [%s]\n", cur_obj,
+				       (unsigned long long)info.adr,
+				       acpi_type[tmp_type]);
+			} else if (!strcmp(cur_obj, "_HID") ||
+			           !strcmp(cur_obj, "_CID")) {
 				get_hid(fd, new_path, hid);
-				tmp_type = get_type(fd, new_path);
-				if (tmp_type == ACPI_TYPE_NOT_FOUND)
-					tmp_type = sizeof(acpi_type) - 1;
 				printf("%s (%s) [%s]\n", cur_obj, hid, acpi_type[tmp_type]);
 			} else if (!strcmp(cur_obj, "_STR") ||
-			           get_type(fd, new_path) == ACPI_TYPE_STRING) {
+			           type == ACPI_TYPE_STRING) {
 				char *str = NULL;
 				get_string(fd, new_path, &str);
-				tmp_type = get_type(fd, new_path);
-				if (tmp_type == ACPI_TYPE_NOT_FOUND)
-					tmp_type = sizeof(acpi_type) - 1;
 				printf("%s (%s) [%s]\n", cur_obj, str, acpi_type[tmp_type]);
 				free(str);
 			} else if (!strcmp(cur_obj, "_STA") ||
-			           get_type(fd, new_path)==ACPI_TYPE_INTEGER) {
-				tmp_type = get_type(fd, new_path);
-				if (tmp_type == ACPI_TYPE_NOT_FOUND)
-					tmp_type = sizeof(acpi_type) - 1;
+			           type == ACPI_TYPE_INTEGER) {
 				printf("%s (0x%llx) [%s]\n", cur_obj,
 				       get_integer(fd, new_path),
 				       acpi_type[tmp_type]);
@@ -509,9 +547,6 @@ print_level(int fd, char *path, int *entries, int level)
 
 				len = dump_raw(fd, new_path, &buf);
 
-				tmp_type = get_type(fd, new_path);
-				if (tmp_type == ACPI_TYPE_NOT_FOUND)
-					tmp_type = sizeof(acpi_type) - 1;
 				if (len <= 0)
 					printf("%s (empty/failed) [%s]\n", cur_obj, acpi_type[tmp_type]);
 				else {
@@ -530,30 +565,110 @@ print_level(int fd, char *path, int *entries, int level)
 					}
 					printf("\n");
 				}
-			} else {
-				tmp_type = get_type(fd, new_path);
-				if (tmp_type == ACPI_TYPE_NOT_FOUND)
-					tmp_type = sizeof(acpi_type) - 1;
+			} else
 				printf("%s [%s]\n", cur_obj, acpi_type[tmp_type]);
-			}
 		}
 
 		entries[level]--;
 		free(new_path);
-		free(cur_obj);
 	}
+	free(nodes);
+
+
+}
+
+/*
+ * Print the tree below path from a single DEV_ACPI_GET_SUBTREE snapshot.
+ * Names and types only, nothing is evaluated.
+ */
+int
+print_subtree(int fd, char *path)
+{
+	dev_acpi_t		data;
+	dev_acpi_subtree_node_t	*nodes;
+	int			entries[ACPI_MAX_STRING] = {0};
+	u32			*left;
+	int			i, cnt, type;
+
+	memset(&data, 0, sizeof(data));
+	strcpy(data.pathname, path);
+
+	if (ioctl(fd, DEV_ACPI_GET_SUBTREE, &data)) {
+		printf("GET_SUBTREE failed at %s (%s)\n", path,
+		       strerror(errno));
+		return 1;
+	}
+
+	cnt = data.return_size / sizeof(*nodes);
+	if (!cnt)
+		return 0;
+
+	nodes = malloc(data.return_size);
+	left = calloc(cnt, sizeof(*left));
+
+	if (!nodes || !left) {
+		free(nodes);
+		free(left);
+		return 1;
+	}
+
+	if (read(fd, nodes, data.return_size) != data.return_size) {
+		free(nodes);
+		free(left);
+		return 1;
+	}
+
+	/* number of children not printed yet, per record */
+	for (i = 1 ; i < cnt ; i++)
+		left[nodes[i].parent]++;
+
+	printf("%s\n", path);
+
+	for (i = 1 ; i < cnt ; i++) {
+		char cur_obj[5];
+
+		if (nodes[i].depth >= ACPI_MAX_STRING)
+			continue;
+
+		entries[nodes[i].depth] = left[nodes[i].parent]--;
+
+		memset(cur_obj, 0, sizeof(cur_obj));
+		memcpy(cur_obj, nodes[i].name, sizeof(nodes[i].name));
+
+		type = nodes[i].type;
+		if (type > ACPI_TYPE_UNKNOWN)
+			type = ACPI_TYPE_UNKNOWN;
+
+		indent(entries, nodes[i].depth);
+		printf("%s [%s]\n", cur_obj, acpi_type[type]);
+	}
+
+	free(nodes);
+	free(left);
+	return 0;
+}
 
+/* Run our evaluations in the background class, older modules don't care */
+static void
+set_background(int fd)
+{
+	dev_acpi_class_t	data;
+
+	memset(&data, 0, sizeof(data));
+	data.eval_class = DEV_ACPI_CLASS_BACKGROUND;
 
+	ioctl(fd, DEV_ACPI_SET_CLASS, &data);
 }
 
 /*
- * No options for now, just print entire tree
+ * Print entire tree, or with -s just the names and types below an
+ * optional path from a single snapshot
  */
 int
 main (int argc, char **argv)
 {
 	int		entries[ACPI_MAX_STRING] = {0}; 
-	int		fd;
+	int		fd, ret;
 
 	fd = open(DEVICE, O_RDONLY);
 
@@ -562,6 +677,19 @@ main (int argc, char **argv)
 		return 1;
 	}
 
+	area = mmap(NULL, AREA_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+	if (area == MAP_FAILED)
+		area = NULL;
+
+	/* a full dump shouldn't hold up anything more urgent */
+	set_background(fd);
+
+	if (argc > 1 && !strcmp(argv[1], "-s")) {
+		ret = print_subtree(fd, argc > 2 ? argv[2] : "\\");
+		close(fd);
+		return ret;
+	}
+
 	printf("\\\\\n");
 	print_level(fd, NULL, entries, 1);	
 	close(fd);
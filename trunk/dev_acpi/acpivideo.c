@@ -113,26 +113,18 @@ get_type(int fd, char *path)
 long long
 get_integer(int fd, char *path)
 {
-	dev_acpi_t		data;
-	union acpi_object	obj;
+	dev_acpi_eval_fast_t	fast;
 
-	memset(&data, 0, sizeof(data));
-	strcpy(data.pathname, path);
+	memset(&fast, 0, sizeof(fast));
+	strcpy(fast.pathname, path);
 
-	if (ioctl(fd, DEV_ACPI_EVALUATE_OBJ, &data)) {
+	if (ioctl(fd, DEV_ACPI_EVAL_FAST, &fast))
 		return -1;
-	}
 
-	if (data.return_size != sizeof(obj))
-		return -1;
-
-	if (read(fd, &obj, data.return_size) != data.return_size)
-		return -1;
-
-	if (obj.type != ACPI_TYPE_INTEGER)
+	if (fast.type != ACPI_TYPE_INTEGER)
 		return -1;
 
-	return obj.integer.value;
+	return fast.value;
 }
 
 long long
@@ -148,45 +140,14 @@ get_method(int fd, char *path, char *method)
 void
 set_dos(int fd, char *path, int value)
 {
-	unsigned char		*buf;
-	struct acpi_object_list *list;
-	union acpi_object	*obj;
-	int			size;
-	dev_acpi_t		data;
-
-	memset(&data, 0, sizeof(data));
-	size = sizeof(struct acpi_object_list) + sizeof(union acpi_object);
-
-	buf = malloc(size);
-
-	if (!buf)
-		return;
-
-	memset(buf, 0, size);
-
-	list = (struct acpi_object_list *)buf;
-
-	list->count = 1;
-	list->pointer = (union acpi_object *)sizeof(struct acpi_object_list);
-
-	obj = (union acpi_object *)((unsigned long)buf +
-	                            sizeof(struct acpi_object_list));
-
-	obj->type = ACPI_TYPE_INTEGER;
-	obj->integer.value = value;
-
-	if (write(fd, buf, size) != size) {
-		printf("%s() Error: write failed: %s\n", __FUNCTION__,
-		       strerror(errno));
-		free(buf);
-		return;
-	}
+	dev_acpi_eval_fast_t	fast;
 
-	free(buf);
-
-	sprintf(data.pathname, "%s._DOS", path);
+	memset(&fast, 0, sizeof(fast));
+	sprintf(fast.pathname, "%s._DOS", path);
+	fast.arg_count = 1;
+	fast.args[0] = value;
 
-	if (ioctl(fd, DEV_ACPI_EVALUATE_OBJ, &data)) {
+	if (ioctl(fd, DEV_ACPI_EVAL_FAST, &fast)) {
 		printf("%s() Error: ioctl failed\n", __FUNCTION__);
 		return;
 	}
@@ -196,45 +157,14 @@ set_dos(int fd, char *path, int value)
 int
 call_dss(int fd, char *path, unsigned int state)
 {
-	unsigned char		*buf;
-	struct acpi_object_list *list;
-	union acpi_object	*obj;
-	int			size;
-	dev_acpi_t		data;
-
-	memset(&data, 0, sizeof(data));
-	size = sizeof(struct acpi_object_list) + sizeof(union acpi_object);
-
-	buf = malloc(size);
-
-	if (!buf)
-		return 0;
-
-	memset(buf, 0, size);
-
-	list = (struct acpi_object_list *)buf;
-
-	list->count = 1;
-	list->pointer = (union acpi_object *)sizeof(struct acpi_object_list);
-
-	obj = (union acpi_object *)((unsigned long)buf +
-	                            sizeof(struct acpi_object_list));
-
-	obj->type = ACPI_TYPE_INTEGER;
-	obj->integer.value = state;
-
-	if (write(fd, buf, size) != size) {
-		printf("%s() Error: write failed: %s\n", __FUNCTION__,
-		       strerror(errno));
-		free(buf);
-		return 0;
-	}
-
-	free(buf);
+	dev_acpi_eval_fast_t	fast;
 
-	sprintf(data.pathname, "%s._DSS", path);
+	memset(&fast, 0, sizeof(fast));
+	sprintf(fast.pathname, "%s._DSS", path);
+	fast.arg_count = 1;
+	fast.args[0] = state;
 
-	if (ioctl(fd, DEV_ACPI_EVALUATE_OBJ, &data)) {
+	if (ioctl(fd, DEV_ACPI_EVAL_FAST, &fast)) {
 		printf("%s() Error: ioctl failed\n", __FUNCTION__);
 		return 0;
 	}
@@ -445,6 +375,100 @@ eval_dod(int fd, char *path, struct vid *vids)
 	return count;
 }
 
+/*
+ * Match the _DOD entries to the devices below the video root by _ADR.
+ * children is the GET_NEXT list, the type and _ADR of every child are
+ * collected with a single DEV_ACPI_BATCH.
+ */
+void
+map_displays(int fd, char *vga, char *children, struct vid *vids,
+             int disp_count)
+{
+	dev_acpi_batch_t	batch;
+	dev_acpi_batch_op_t	*ops;
+	dev_acpi_batch_result_t	*res;
+	union acpi_object	*obj;
+	char			*a, *b, *buf;
+	int			i, j, count, size;
+
+	count = 0;
+	for (a = children ; (b = strchr(a, '\n')) != NULL ; a = b + 1)
+		count++;
+
+	if (!count)
+		return;
+
+	size = 2 * count * sizeof(*ops);
+	ops = malloc(size);
+
+	if (!ops) {
+		printf("%s() ERROR: malloc failed\n", __FUNCTION__);
+		return;
+	}
+	memset(ops, 0, size);
+
+	i = 0;
+	for (a = children ; (b = strchr(a, '\n')) != NULL ; a = b + 1) {
+		*b = '\0';
+
+		ops[i].cmd = DEV_ACPI_GET_TYPE;
+		sprintf(ops[i].pathname, "%s.%s", vga, a);
+		ops[i + 1].cmd = DEV_ACPI_EVALUATE_OBJ;
+		sprintf(ops[i + 1].pathname, "%s.%s._ADR", vga, a);
+		i += 2;
+	}
+
+	if (write(fd, ops, size) != size) {
+		printf("%s() ERROR: write failed: %s\n", __FUNCTION__,
+		       strerror(errno));
+		free(ops);
+		return;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.count = 2 * count;
+
+	if (ioctl(fd, DEV_ACPI_BATCH, &batch) || !batch.return_size) {
+		printf("%s() ERROR: BATCH failed: %s\n", __FUNCTION__,
+		       strerror(errno));
+		free(ops);
+		return;
+	}
+
+	buf = malloc(batch.return_size);
+
+	if (!buf || read(fd, buf, batch.return_size) != batch.return_size) {
+		printf("%s() ERROR: unable to read batch results\n",
+		       __FUNCTION__);
+		free(buf);
+		free(ops);
+		return;
+	}
+
+	res = (dev_acpi_batch_result_t *)buf;
+
+	for (i = 0 ; i < 2 * count ; i += 2) {
+		if (res[i].status || !res[i].length ||
+		    res[i + 1].status || !res[i + 1].length)
+			continue;
+
+		obj = (union acpi_object *)(buf + res[i].offset);
+		if (obj->integer.value != ACPI_TYPE_DEVICE)
+			continue;
+
+		obj = (union acpi_object *)(buf + res[i + 1].offset);
+		if (obj->type != ACPI_TYPE_INTEGER)
+			continue;
+
+		for (j = 0 ; j < disp_count ; j++)
+			if ((vids[j].dod & 0xFFFFU) == obj->integer.value)
+				sprintf(vids[j].path, "%s", ops[i].pathname);
+	}
+
+	free(buf);
+	free(ops);
+}
+
 void
 handle_signal(int sig)
 {
@@ -456,11 +480,8 @@ main (int argc, char **argv)
 {
 	int		fd, i, j, disp_count;
 	char		*chr, *dod_path, *video_root, *tmp;
-	char		*a, *b;
 	struct vid	vids[MAX_VIDS];
 	char		vga[ACPI_PATHNAME_MAX];
-	char		str[ACPI_PATHNAME_MAX];
-	unsigned int	tmp_adr;
 
 	memset(vids, 0, MAX_VIDS * sizeof(struct vid));
 	fd = open(DEVICE, O_RDWR | O_NONBLOCK);
@@ -517,28 +538,7 @@ main (int argc, char **argv)
 		return 1;
 	}
 
-	a = tmp;
-	b = strchr(a, '\n');
-
-	do {
-		if (b)
-			*b = '\0';
-
-		memset(str, 0, ACPI_PATHNAME_MAX);
-		sprintf(str , "%s.%s", vga, a);
-
-		a = ++b;
-
-		if (get_type(fd, str) != ACPI_TYPE_DEVICE)
-			continue;
-
-		tmp_adr = get_method(fd, str, "_ADR");
-		for (i = 0 ; i < disp_count ; i++)
-			if ((vids[i].dod & 0xFFFFU) == tmp_adr)
-				sprintf(vids[i].path, "%s", str);
-
-	} while ((b = strchr(a, '\n')) != NULL);
-
+	map_displays(fd, vga, tmp, vids, disp_count);
 	free(tmp);
 	
 	if (signal(SIGINT, handle_signal) == SIG_ERR)
@@ -611,7 +611,7 @@ again:
 	{
 		dev_acpi_t	data;
 		int		ev;
-		char		event[ACPI_PATHNAME_MAX];
+		char		event[ACPI_PATHNAME_MAX + 16];
 
 		ev = open(DEVICE, O_RDWR);
 		strcpy(data.pathname, vga);
@@ -622,8 +622,9 @@ again:
 			goto done;
 		}
 
-		read(ev, event, ACPI_PATHNAME_MAX);
-		printf("\nEvent: %s\n\n", event);
+		memset(event, 0, sizeof(event));
+		read(ev, event, sizeof(event) - 1);
+		printf("\nEvent: %s\n", event);
 		close(ev);
 		goto again;
 	}
@@ -29,17 +29,39 @@
 # define __user
 # define try_module_get(x) MOD_INC_USE_COUNT
 # define module_put(x) MOD_DEC_USE_COUNT
+# define module_param(name, type, perm) MODULE_PARM(name, "i")
+# define module_param_string(name, string, len, perm) \
+	MODULE_PARM(string, "c" __MODULE_STRING(len))
+# define msecs_to_jiffies(ms) (((ms) * HZ + 999) / 1000)
 #endif
 
 #include <linux/kernel.h>
 #include <linux/types.h>
 #include <linux/fs.h>
 #include <linux/ioctl.h>
+#include <linux/jhash.h>
 #include <linux/list.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/vmalloc.h>
+#include <linux/wait.h>
 #ifdef CONFIG_COMPAT
+# include <linux/compat.h>
 # include <linux/ioctl32.h>
 # include <linux/syscalls.h>
 #endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,0)
+# include <linux/rcupdate.h>
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,4)
+/* samplers and async requests need a worker thread */
+# include <linux/kthread.h>
+# define DEV_ACPI_KTHREAD
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16)
+# include <linux/ktime.h>
+#endif
 
 #include <asm/semaphore.h>
 #include <asm/uaccess.h>
@@ -50,12 +72,212 @@
 
 #include "dev_acpi.h"
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,0)
+/*
+ * No RCU on 2.4.  The notify handler and the code changing subscriber
+ * lists share a lock instead, so anything unlinked under it can be freed
+ * straight away.
+ */
+static spinlock_t dev_acpi_rcu_lock = SPIN_LOCK_UNLOCKED;
+
+struct rcu_head {
+	int	unused;
+};
+
+# define rcu_read_lock()		spin_lock_bh(&dev_acpi_rcu_lock)
+# define rcu_read_unlock()		spin_unlock_bh(&dev_acpi_rcu_lock)
+# define list_for_each_rcu		list_for_each
+# define list_add_tail_rcu(new, head)	do { \
+	spin_lock_bh(&dev_acpi_rcu_lock); \
+	list_add_tail(new, head); \
+	spin_unlock_bh(&dev_acpi_rcu_lock); \
+} while (0)
+# define list_del_rcu(entry)		do { \
+	spin_lock_bh(&dev_acpi_rcu_lock); \
+	list_del(entry); \
+	spin_unlock_bh(&dev_acpi_rcu_lock); \
+} while (0)
+# define call_rcu(head, func)		func(head)
+# define synchronize_rcu()		do { } while (0)
+#else
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,10)
+/* call_rcu() used to take the callback's argument separately */
+#  define call_rcu(head, func) \
+	call_rcu(head, (void (*)(void *))(func), head)
+# endif
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2,6,12)
+#  define synchronize_rcu synchronize_kernel
+# endif
+#endif
+
 MODULE_AUTHOR("Alex Williamson, HP (alex.williamson@hp.com)");
 MODULE_DESCRIPTION("Device file access to ACPI namespace");
 MODULE_LICENSE("GPL");
 
 static int major;
 
+static unsigned int event_depth = 32;
+module_param(event_depth, uint, 0644);
+MODULE_PARM_DESC(event_depth, "Default number of queued notify events per open");
+
+#define EVENT_DEPTH_MAX	4096
+
+/*
+ * Evaluation result cache, off unless eval_cache names some objects.
+ * Entries are "NAME" or "NAME:ms", without a time eval_cache_ttl applies.
+ */
+#define EVAL_CACHE_NAMES_LEN	256
+
+static char eval_cache[EVAL_CACHE_NAMES_LEN];
+/* a literal length, 2.4 puts it in the MODULE_PARM type string */
+module_param_string(eval_cache, eval_cache, EVAL_CACHE_NAMES_LEN, 0444);
+MODULE_PARM_DESC(eval_cache, "Objects whose results are cached, eg. _HID,_CID,_UID,_ADR,_DOD,_BCL,_BIF:5000");
+
+static unsigned int eval_cache_ttl = 10000;
+module_param(eval_cache_ttl, uint, 0444);
+MODULE_PARM_DESC(eval_cache_ttl, "Default eval_cache lifetime in ms");
+
+static unsigned int eval_slots;
+module_param(eval_slots, uint, 0444);
+MODULE_PARM_DESC(eval_slots, "Evaluations run at once, 0 (default) = no scheduling");
+
+/* Longest coalescing window, in ms */
+#define NOTIFY_WINDOW_MAX	60000
+
+/*
+ * Namespace generation.  Bumped whenever the namespace may have changed
+ * (table load/unload, hotplug notifies, DEV_ACPI_FLUSH_CACHES).  Anything
+ * holding on to handles across calls checks it before trusting them.
+ */
+static atomic_t ns_generation = ATOMIC_INIT(1);
+
+/*
+ * Set while the table handler is installed.  Without it nothing tells us
+ * about tables loaded or unloaded, so nothing tagged with a generation is
+ * trusted and every lookup goes to the live namespace.
+ */
+static int ns_tracked;
+
+/*
+ * NameSeg -> handles index for DEV_ACPI_GET_OBJECTS.  Entries are in
+ * namespace walk order and chained by index per hash bucket.  Rebuilt on
+ * first use after the namespace generation changes.
+ */
+#define NAME_INDEX_BUCKETS	1024	/* must be a power of 2 */
+#define NAME_INDEX_END		0xffffffff
+
+struct name_index_entry {
+	u32			name;	/* NameSeg as a u32 */
+	u32			next;	/* next entry in bucket */
+	acpi_handle		handle;
+};
+
+static struct name_index_entry *name_index;
+static u32 name_index_count, name_index_size, name_index_generation;
+static u32 name_index_buckets[NAME_INDEX_BUCKETS];
+static u64 name_index_rebuilds;
+static DECLARE_MUTEX(name_index_sem);
+
+/*
+ * _HID/_CID -> device index for DEV_ACPI_GET_DEVICES, so lookups don't
+ * run _HID and _CID on every device.  One entry per distinct ID per
+ * device, present or not, buckets kept in namespace walk order.  _STA
+ * can change without any notify reaching us, it's evaluated for the
+ * matches at lookup time.  Rebuilt on first use after the namespace
+ * generation changes.
+ */
+#define HID_INDEX_BUCKETS	64	/* must be a power of 2 */
+
+struct hid_index_entry {
+	struct list_head	node;
+	acpi_handle		handle;
+	char			id[ACPI_MAX_CID_LENGTH];
+	char			uid[ACPI_MAX_CID_LENGTH];
+};
+
+static struct list_head hid_index[HID_INDEX_BUCKETS];
+static int hid_index_valid;
+static u32 hid_index_generation;
+static u64 hid_index_rebuilds;
+static DECLARE_MUTEX(hid_index_sem);
+
+/*
+ * Cached results of the objects named by eval_cache, keyed by handle and
+ * arguments.  A pending entry is an evaluation in flight, identical
+ * requests wait for it instead of running the method again.  Results are
+ * offset encoded, so they're copied out as is.  Entries with refs held
+ * or pending are never freed.  Results are only reused while the
+ * namespace generation is tracked, otherwise there's just coalescing.
+ */
+#define EVAL_CACHE_NAMES_MAX	32
+#define EVAL_CACHE_BUCKETS	64	/* must be a power of 2 */
+#define EVAL_CACHE_MAX		256	/* entries */
+#define EVAL_KEY_MAX		128	/* serialized arguments */
+
+struct eval_cache_name {
+	u32			name;		/* NameSeg as a u32 */
+	unsigned long		ttl;		/* jiffies */
+};
+
+struct eval_cache_entry {
+	struct list_head	node;		/* hash bucket */
+	struct list_head	lru;
+	acpi_handle		handle;
+	u32			hash;
+	u32			generation;
+	unsigned long		expires;
+	int			pending;
+	int			refs;
+	int			status;		/* dev_acpi_evaluate() return */
+	void			*result;
+	u32			length;
+	u32			key_len;
+	u8			key[EVAL_KEY_MAX];
+};
+
+static struct eval_cache_name eval_cache_names[EVAL_CACHE_NAMES_MAX];
+static unsigned int eval_cache_name_count;
+static struct list_head eval_cache_buckets[EVAL_CACHE_BUCKETS];
+static LIST_HEAD(eval_cache_lru);
+static unsigned int eval_cache_count;
+static spinlock_t eval_cache_lock = SPIN_LOCK_UNLOCKED;
+static DECLARE_WAIT_QUEUE_HEAD(eval_cache_wait);
+static u64 eval_cache_hits, eval_cache_misses, eval_cache_coalesced;
+
+/*
+ * Evaluation scheduler.  ACPI CA runs AML one method at a time anyway,
+ * so evaluations are admitted eval_slots at a time from a queue per
+ * priority class.  Classes share the slots by stride scheduling: the
+ * waiting class with the lowest pass goes next and its pass advances by
+ * EVAL_STRIDE / weight, so a critical reader waits for at most the
+ * evaluations already running plus a few others, however deep the
+ * background queue is.
+ */
+#define EVAL_STRIDE		(1 << 16)
+
+static const unsigned int eval_class_weight[DEV_ACPI_CLASSES] = {
+	16,	/* DEV_ACPI_CLASS_CRITICAL */
+	4,	/* DEV_ACPI_CLASS_NORMAL */
+	1,	/* DEV_ACPI_CLASS_BACKGROUND */
+};
+
+struct eval_waiter {
+	struct list_head	node;
+	wait_queue_head_t	wait;
+	int			go;
+};
+
+struct eval_class {
+	struct list_head	queue;		/* eval_waiter */
+	u64			pass;
+	dev_acpi_class_stats_t	stats;
+};
+
+static struct eval_class eval_classes[DEV_ACPI_CLASSES];
+static unsigned int eval_running;
+static u64 eval_vtime;		/* pass of the last class dispatched */
+static spinlock_t eval_sched_lock = SPIN_LOCK_UNLOCKED;
+
 #define DEV_ACPI_NAME "dev_acpi"
 #define DEV_ACPI_DEVICE_NAME "acpi"
 
@@ -84,26 +306,375 @@ static int major;
 # endif
 #endif
 
-typedef struct {
-	struct semaphore	sem;
+/* An object opened with DEV_ACPI_OPEN_HANDLE */
+struct handle_id {
+	acpi_handle		handle;
+	u32			generation;
+	char			*pathname;	/* NULL if the slot is free */
+};
+
+#define HANDLE_IDS_MAX		256
+
+/* Most operations in one DEV_ACPI_BATCH */
+#define BATCH_OPS_MAX		256
+
+/* Largest result area a client can mmap, see DEV_ACPI_EVALUATE_MMAP */
+#define MMAP_AREA_MAX		(256 * 1024)
+
+/*
+ * Objects sampled by the per open worker, see DEV_ACPI_SAMPLER_ADD.
+ * Results go to a ring of SAMPLER_SLOTS records after a small header.
+ */
+#define SAMPLERS_MAX		256
+#define SAMPLER_SLOTS		2048	/* must be a power of 2 */
+#define SAMPLER_INTERVAL_MIN	10	/* ms */
+#define SAMPLER_INTERVAL_MAX	3600000
+#define SAMPLER_RING_SIZE	PAGE_ALIGN(sizeof(dev_acpi_sampler_ring_t) + \
+				           SAMPLER_SLOTS * \
+				           sizeof(dev_acpi_sample_t))
+
+/* Evaluations outstanding per open, queued or done and not reaped */
+#define ASYNC_MAX		256
+
+struct async_req {
+	struct list_head	node;	/* async_queue or async_done */
+	u64			tag;
+	acpi_handle		handle;
+	u32			arg_count;
+	u64			args[DEV_ACPI_FAST_ARGS];
+	u64			submitted;	/* ns, monotonic */
+	u64			latency;
+	int			status;
+	struct acpi_buffer	result;		/* offset encoded */
+};
+
+struct sampler_entry {
+	struct list_head	node;
+	u32			id;
+	u32			flags;		/* DEV_ACPI_SAMPLER_* */
+	unsigned long		interval;	/* jiffies */
+	unsigned long		due;		/* next sample */
+	char			*pathname;	/* resolved each time */
+	int			have_value;	/* value is valid */
+	u64			value;		/* last result, changes only */
+};
+
+/*
+ * A queued notify or value change event.  sub (sampler) is NULL once
+ * the subscription (sampler) is gone.
+ */
+struct event_rec {
+	struct notify_list	*sub;
+	struct sampler_entry	*sampler;	/* value change events */
+	u32			id;		/* of the subscription */
+	u32			event;
+	u64			timestamp;	/* ns, monotonic */
+	u32			count;		/* events coalesced into this */
+	u64			old_value;	/* value change events */
+	u64			new_value;
+};
+
+/*
+ * Read and write buffers.  There's one shared per open, or after
+ * DEV_ACPI_PER_THREAD one per calling thread so threads sharing the fd
+ * don't see each other's results.
+ */
+#define THREAD_CTX_MAX		64
+
+struct file_ctx {
+	struct list_head	node;	/* ctxs, under lock */
+	/* owning thread, a pid alone gets reused once the thread exits */
+	pid_t			pid;
+	typeof(((struct task_struct *)0)->start_time) start;
+	int			users;	/* calls in progress, under lock */
+	unsigned long		used;	/* jiffies, last call */
+	int			ready;	/* read buffer has data not yet read */
+	loff_t			pos;	/* read position, per thread only */
 	struct acpi_buffer	read;
 	struct acpi_buffer	write;
+};
+
+typedef struct {
+	spinlock_t		lock;	/* protects ready and the event ring */
+	wait_queue_head_t	wait;	/* read() and poll() wait here */
+	u32			eval_class;	/* DEV_ACPI_CLASS_* */
+	struct file_ctx		shared;	/* unless per_thread */
+	struct semaphore	shared_sem;	/* one call at a time on it */
+	struct list_head	ctxs;	/* per thread contexts, under lock */
+	unsigned int		ctx_count;
+	int			per_thread;
+	struct semaphore	subs_sem;	/* notify list */
 	struct list_head	notify;
+	struct event_rec	*events;	/* ring of ev_depth slots */
+	unsigned int		ev_depth;
+	unsigned int		ev_head;	/* oldest queued event */
+	unsigned int		ev_count;	/* number of queued events */
+	u32			ev_seq;		/* events ever queued */
+	u32			ev_overflows;
+	int			ev_binary;	/* dev_acpi_event_t records */
+	u32			notify_ids;	/* last subscription ID */
+	struct semaphore	ids_sem;
+	struct handle_id	*ids;		/* HANDLE_IDS_MAX slots */
+	void			*area;		/* mmap'd result area */
+	unsigned long		area_size;
+	struct list_head	samplers;	/* under sampler_sem */
+	struct semaphore	sampler_sem;
+	struct task_struct	*sampler;	/* worker, NULL if none */
+	wait_queue_head_t	sampler_wait;	/* worker sleeps here */
+	int			sampler_kick;	/* list changed */
+	u32			sampler_ids;	/* last sampler ID */
+	unsigned int		change_samplers;	/* queue events */
+	dev_acpi_sampler_ring_t	*ring;		/* sample ring, mmap'able */
+	u32			ring_head;	/* our copy of ring->head */
+	struct list_head	async_queue;	/* under lock */
+	struct list_head	async_done;	/* under lock */
+	unsigned int		async_count;	/* outstanding, under lock */
+	struct semaphore	async_sem;	/* starting the worker */
+	struct task_struct	*async;		/* worker, NULL if none */
+	wait_queue_head_t	async_wait;	/* worker sleeps here */
 } priv_data_t;
 
+/*
+ * ACPI CA allows one notify handler per object and type, so the module
+ * installs it once and fans events out to every file subscribed.  Sources
+ * are hashed by object and type under notify_sem, the handler walks the
+ * subscribers under RCU.  The handler goes when the last one leaves, but
+ * the source stays until the module is unloaded: a notify already queued
+ * by ACPI CA can still run with it after the handler is removed.
+ */
+#define NOTIFY_SOURCE_BUCKETS	64	/* must be a power of 2 */
+
+struct notify_source {
+	struct list_head	node;	/* hash chain, notify_sem */
+	struct list_head	subs;	/* notify_list entries, RCU */
+	acpi_handle		device;
+	u32			type;
+	unsigned int		refs;	/* subscribers, notify_sem */
+	char			*pathname;	/* looked up once */
+};
+
+/*
+ * A file's subscription to a notify source.  dead is set under the
+ * file's lock before it goes, so no new events point at it.
+ */
 struct notify_list {
-	struct list_head	node;
+	struct list_head	node;	/* on the file's notify list */
+	struct list_head	sub;	/* on source->subs */
+	struct rcu_head		rcu;
+	struct notify_source	*source;
+	priv_data_t		*priv;
 	acpi_handle		device;
 	u32			type;
+	u32			id;	/* reported with each event */
+	int			dead;
+	/* filtering and counters, under the file's lock */
+	u32			mask[DEV_ACPI_EVENT_MASK_WORDS];
+	u32			window_ms;	/* coalescing window */
+	u32			last_seq;	/* last event queued */
+	u64			delivered;
+	u64			filtered;
+	u64			coalesced;
+	u64			overflows;
 };
+
+static struct list_head notify_sources[NOTIFY_SOURCE_BUCKETS];
+static DECLARE_MUTEX(notify_sem);
 	
-#define RBUF(x)			(&((priv_data_t *)(x->private_data))->read)
-#define WBUF(x)			(&((priv_data_t *)(x->private_data))->write)
+#define RBUF(x)			(&dev_acpi_ctx(x)->read)
+#define WBUF(x)			(&dev_acpi_ctx(x)->write)
 
 #define PADDR(ptr)		((unsigned long)(ptr))
 #define PADDR_END(ptr, size)	(PADDR(ptr) + PADDR(size))
 #define POFFSET(ptr, end)	(PADDR(end) - PADDR(ptr))
 
+/* Does ctx belong to the calling thread? */
+static int
+file_ctx_mine(struct file_ctx *ctx)
+{
+	return ctx->pid == current->pid &&
+	       !memcmp(&ctx->start, &current->start_time, sizeof(ctx->start));
+}
+
+/*
+ * The calling thread's buffers.  The context is set up on the way in by
+ * dev_acpi_ctx_get() and held for the call.
+ */
+static struct file_ctx *
+dev_acpi_ctx(struct file *f)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+	struct file_ctx	*ctx, *found = &priv->shared;
+
+	if (!priv->per_thread)
+		return found;
+
+	spin_lock(&priv->lock);
+	list_for_each_entry(ctx, &priv->ctxs, node) {
+		if (file_ctx_mine(ctx)) {
+			found = ctx;
+			break;
+		}
+	}
+	spin_unlock(&priv->lock);
+
+	return found;
+}
+
+/*
+ * Does the calling thread have a result waiting?  For poll(), which runs
+ * without a context held.  Contexts are only unlinked under the lock, so
+ * holding it keeps this one from being freed while we look.
+ */
+static int
+dev_acpi_ready_mine(struct file *f)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+	struct file_ctx	*ctx;
+	int		ready = 0;
+
+	spin_lock(&priv->lock);
+	if (!priv->per_thread)
+		ready = priv->shared.ready;
+	else {
+		list_for_each_entry(ctx, &priv->ctxs, node) {
+			if (file_ctx_mine(ctx)) {
+				ready = ctx->ready;
+				break;
+			}
+		}
+	}
+	spin_unlock(&priv->lock);
+
+	return ready;
+}
+
+static void
+file_ctx_free(struct file_ctx *ctx)
+{
+	kfree(ctx->read.pointer);
+	kfree(ctx->write.pointer);
+	kfree(ctx);
+}
+
+/*
+ * Find or create the calling thread's context and hold it for the call.
+ * A context left by an exited thread whose pid we now have is dropped.
+ * With THREAD_CTX_MAX contexts the least recently used one that's idle
+ * and has no unread result is recycled.  Calls on the shared context are
+ * serialized.
+ */
+static struct file_ctx *
+dev_acpi_ctx_get(struct file *f)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+	struct file_ctx	*ctx, *new = NULL, *old = NULL, *stale = NULL;
+
+	if (!priv->per_thread) {
+		if (down_interruptible(&priv->shared_sem))
+			return ERR_PTR(-ERESTARTSYS);
+		return &priv->shared;
+	}
+
+again:
+	spin_lock(&priv->lock);
+
+	list_for_each_entry(ctx, &priv->ctxs, node) {
+		if (file_ctx_mine(ctx)) {
+			ctx->users++;
+			ctx->used = jiffies;
+			spin_unlock(&priv->lock);
+			kfree(new);
+			return ctx;
+		}
+
+		/* pids are unique among live threads, its owner is gone */
+		if (ctx->pid == current->pid && !ctx->users)
+			stale = ctx;
+	}
+
+	if (stale) {
+		list_del(&stale->node);
+		priv->ctx_count--;
+		spin_unlock(&priv->lock);
+		file_ctx_free(stale);
+		stale = NULL;
+		goto again;
+	}
+
+	if (!new) {
+		spin_unlock(&priv->lock);
+
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return ERR_PTR(-ENOMEM);
+		goto again;
+	}
+
+	if (priv->ctx_count == THREAD_CTX_MAX) {
+		list_for_each_entry(ctx, &priv->ctxs, node) {
+			if (!ctx->users && !ctx->ready && (!old ||
+			    time_before(ctx->used, old->used)))
+				old = ctx;
+		}
+
+		if (!old) {
+			spin_unlock(&priv->lock);
+			kfree(new);
+			return ERR_PTR(-EBUSY);
+		}
+
+		list_del(&old->node);
+		priv->ctx_count--;
+	}
+
+	memset(new, 0, sizeof(*new));
+	new->pid = current->pid;
+	new->start = current->start_time;
+	new->users = 1;
+	new->used = jiffies;
+	list_add(&new->node, &priv->ctxs);
+	priv->ctx_count++;
+
+	spin_unlock(&priv->lock);
+
+	if (old)
+		file_ctx_free(old);
+	return new;
+}
+
+static void
+dev_acpi_ctx_put(
+	struct file	*f,
+	struct file_ctx	*ctx)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+
+	if (ctx == &priv->shared) {
+		up(&priv->shared_sem);
+		return;
+	}
+
+	spin_lock(&priv->lock);
+	ctx->users--;
+	spin_unlock(&priv->lock);
+}
+
+/*
+ * Event, sample and latency timestamps in ns on a monotonic clock.  Only
+ * jiffy resolution before ktime.
+ */
+static u64
+dev_acpi_now(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,16)
+	return ktime_to_ns(ktime_get());
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,0)
+	return (u64)(get_jiffies_64() - INITIAL_JIFFIES) * (1000000000 / HZ);
+#else
+	return (u64)jiffies * (1000000000 / HZ);
+#endif
+}
+
 static char *
 strdup(char *orig)
 {
@@ -287,6 +858,115 @@ fixup_arglist(struct acpi_buffer *buffer)
 	return arg_list;
 }
 
+/*
+ * Append-only buffer used to build up list style results.  The allocation
+ * grows geometrically, so building a result of n entries costs O(n) copies
+ * instead of reallocating and copying the whole result for every entry.
+ */
+typedef struct {
+	char	*pointer;
+	size_t	length;
+	size_t	size;
+} result_buf_t;
+
+#define RESULT_BUF_MIN	256
+
+static int
+result_buf_reserve(
+	result_buf_t	*rb,
+	size_t		len)
+{
+	size_t	new_size;
+	char	*new_buf;
+
+	if (rb->length + len <= rb->size)
+		return 1;
+
+	new_size = rb->size ? rb->size : RESULT_BUF_MIN;
+	while (new_size < rb->length + len)
+		new_size <<= 1;
+
+	new_buf = kmalloc(new_size, GFP_KERNEL);
+	if (!new_buf)
+		return 0;
+
+	if (rb->pointer) {
+		memcpy(new_buf, rb->pointer, rb->length);
+		kfree(rb->pointer);
+	}
+
+	rb->pointer = new_buf;
+	rb->size = new_size;
+	return 1;
+}
+
+static int
+result_buf_append(
+	result_buf_t	*rb,
+	const void	*data,
+	size_t		len)
+{
+	if (!result_buf_reserve(rb, len))
+		return 0;
+
+	memcpy(rb->pointer + rb->length, data, len);
+	rb->length += len;
+	return 1;
+}
+
+/* Append a string as a line of an ASCII list */
+static int
+result_buf_append_line(
+	result_buf_t	*rb,
+	char		*str)
+{
+	size_t	len = strlen(str);
+
+	if (!result_buf_reserve(rb, len + 1))
+		return 0;
+
+	memcpy(rb->pointer + rb->length, str, len);
+	rb->pointer[rb->length + len] = '\n';
+	rb->length += len + 1;
+	return 1;
+}
+
+static void
+result_buf_free(result_buf_t *rb)
+{
+	kfree(rb->pointer);
+	rb->pointer = NULL;
+	rb->length = rb->size = 0;
+}
+
+/*
+ * Hand the contents off to an acpi_buffer.  ASCII lists get a string
+ * terminator, an empty result leaves the acpi_buffer empty.
+ */
+static int
+result_buf_finish(
+	result_buf_t		*rb,
+	struct acpi_buffer	*buffer,
+	int			terminate)
+{
+	if (!rb->length) {
+		result_buf_free(rb);
+		return 1;
+	}
+
+	if (terminate && !result_buf_append(rb, "", 1)) {
+		result_buf_free(rb);
+		return 0;
+	}
+
+	buffer->pointer = rb->pointer;
+	buffer->length = rb->length;
+
+	rb->pointer = NULL;
+	rb->length = rb->size = 0;
+	return 1;
+}
+
 /*
  * Clean up the private data pointer
  */
@@ -296,14 +976,21 @@ fixup_arglist(struct acpi_buffer *buffer)
 static void
 dev_acpi_clear(struct file *f, int type)
 {
+	priv_data_t *priv = (priv_data_t *)f->private_data;
+	struct file_ctx *ctx = dev_acpi_ctx(f);
 	struct acpi_buffer *buffer;
 	
 	while (type) {
 		if (type & READ_CLEAR) {
-			buffer = RBUF(f);
+			buffer = &ctx->read;
 			type &= ~READ_CLEAR;
+			ctx->ready = 0;
+			if (ctx == &priv->shared)
+				f->f_pos = 0;
+			else
+				ctx->pos = 0;
 		} else if (type & WRITE_CLEAR) {
-			buffer = WBUF(f);
+			buffer = &ctx->write;
 			type &= ~WRITE_CLEAR;
 		} else
 			return;
@@ -318,55 +1005,353 @@ dev_acpi_clear(struct file *f, int type)
 }
 
 /*
- * Try to handle paths from the filesystem, guess root from "ACPI"
- * directory, convert '/' to '.'.  Should I just let userpsace
- * take care of this?
+ * New data has been placed in the read buffer, let anyone waiting in
+ * read() or poll() know about it.
  */
-static char *
-dev_acpi_parse_path(char *orig_path)
+static void
+dev_acpi_ready(struct file *f)
 {
-	char *new_path, *tmp;
-
-	tmp = strstr(orig_path, "ACPI");
-	if (tmp)
-		tmp += 5;
-	else
-		tmp = orig_path;
-
-	new_path = strdup(tmp);
+	priv_data_t *priv = (priv_data_t *)f->private_data;
+	struct file_ctx *ctx = dev_acpi_ctx(f);
 
-	if (!new_path)
-		return NULL;
+	spin_lock(&priv->lock);
+	ctx->ready = 1;
+	spin_unlock(&priv->lock);
 
-	while ((tmp = strchr(new_path, '/')) != NULL)
-		*tmp = '.';
+	/* new result, read it from the start */
+	if (ctx == &priv->shared)
+		f->f_pos = 0;
+	else
+		ctx->pos = 0;
 
-	return new_path;
+	wake_up_interruptible(&priv->wait);
 }
 
 /*
- * Given path, try to get an ACPI handle
+ * Events are queued in a ring of preallocated slots so the notify
+ * handler never has to allocate.  (Re)size the ring, keeping any
+ * events already queued that still fit.
  */
-static acpi_handle
-dev_acpi_get_handle(char *path)
+static int
+dev_acpi_event_ring(
+	priv_data_t	*priv,
+	unsigned int	depth)
 {
-	char *new_path;
-	acpi_handle handle;
-	acpi_status status;
+	struct event_rec	*new_ring, *old_ring;
+	unsigned int		i;
 
-	if (!strlen(path))
-		return ACPI_ROOT_OBJECT;
+	if (!depth || depth > EVENT_DEPTH_MAX)
+		return -EINVAL;
 
-	new_path = dev_acpi_parse_path(path);
+	if (priv->events && depth == priv->ev_depth)
+		return 0;
 
-	if (!new_path)
-		return NULL;
+	new_ring = kmalloc(depth * sizeof(*new_ring), GFP_KERNEL);
+	if (!new_ring)
+		return -ENOMEM;
+
+	memset(new_ring, 0, depth * sizeof(*new_ring));
+
+	spin_lock(&priv->lock);
+
+	old_ring = priv->events;
+
+	for (i = 0 ; i < priv->ev_count && i < depth ; i++)
+		new_ring[i] = old_ring[(priv->ev_head + i) % priv->ev_depth];
+
+	priv->ev_overflows += priv->ev_count - i;
+	priv->ev_seq -= priv->ev_count - i;
+	priv->ev_count = i;
+	priv->ev_head = 0;
+	priv->ev_depth = depth;
+	priv->events = new_ring;
+
+	spin_unlock(&priv->lock);
+
+	kfree(old_ring);
+	return 0;
+}
+
+/* Longest text event, a value change with two 64bit values */
+#define EVENT_LINE_MAX	(ACPI_PATHNAME_MAX + 48)
+
+/*
+ * Pull the oldest event off the ring, as a "%s,%08x\n" line or a
+ * dev_acpi_event_t in binary mode, if it fits in len bytes.  out must
+ * have room for EVENT_LINE_MAX.  Returns the size, 0 if there's nothing
+ * queued or -EINVAL if it doesn't fit.
+ */
+static int
+dev_acpi_event_pop(
+	priv_data_t	*priv,
+	char		*out,
+	size_t		len)
+{
+	struct event_rec	*rec;
+	dev_acpi_event_t	ev;
+	char			*pathname;
+	int			size;
+
+	spin_lock(&priv->lock);
+
+	if (!priv->ev_count) {
+		spin_unlock(&priv->lock);
+		return 0;
+	}
+
+	rec = &priv->events[priv->ev_head];
+
+	if (priv->ev_binary) {
+		size = sizeof(ev);
+
+		if (size > len) {
+			spin_unlock(&priv->lock);
+			return -EINVAL;
+		}
+
+		ev.id = rec->id;
+		ev.event = rec->event;
+		ev.timestamp = rec->timestamp;
+		ev.count = rec->count;
+		ev.reserved = 0;
+		ev.old_value = rec->old_value;
+		ev.new_value = rec->new_value;
+		memcpy(out, &ev, size);
+	} else {
+		if (rec->sub)
+			pathname = rec->sub->source->pathname;
+		else if (rec->sampler)
+			pathname = rec->sampler->pathname;
+		else
+			pathname = "????";
+
+		/* out has room for the longest line */
+		if (rec->event == DEV_ACPI_EVENT_VALUE_CHANGE)
+			size = sprintf(out, "%s,%08x,%llx,%llx\n", pathname,
+			               rec->event,
+			               (unsigned long long)rec->old_value,
+			               (unsigned long long)rec->new_value);
+		else
+			size = sprintf(out, "%s,%08x\n", pathname, rec->event);
+
+		if (size > len) {
+			spin_unlock(&priv->lock);
+			return -EINVAL;
+		}
+	}
+
+	priv->ev_head = (priv->ev_head + 1) % priv->ev_depth;
+	priv->ev_count--;
+
+	spin_unlock(&priv->lock);
+	return size;
+}
+
+/*
+ * Try to handle paths from the filesystem, guess root from "ACPI"
+ * directory, convert '/' to '.'.  Should I just let userpsace
+ * take care of this?
+ */
+static char *
+dev_acpi_parse_path(char *orig_path)
+{
+	char *new_path, *tmp;
+
+	tmp = strstr(orig_path, "ACPI");
+	if (tmp)
+		tmp += 5;
+	else
+		tmp = orig_path;
+
+	new_path = strdup(tmp);
+
+	if (!new_path)
+		return NULL;
+
+	while ((tmp = strchr(new_path, '/')) != NULL)
+		*tmp = '.';
+
+	return new_path;
+}
+
+static void
+dev_acpi_ns_changed(void)
+{
+	atomic_inc(&ns_generation);
+}
+
+/* Is something tagged with generation gen still current? */
+static int
+dev_acpi_ns_current(u32 gen)
+{
+	return ns_tracked && gen == atomic_read(&ns_generation);
+}
+
+/*
+ * Given path, try to get an ACPI handle
+ */
+static acpi_handle
+dev_acpi_get_handle(char *path)
+{
+	char *new_path;
+	acpi_handle handle;
+	acpi_status status;
+	size_t len;
+
+	len = strnlen(path, ACPI_PATHNAME_MAX);
+
+	if (!len)
+		return ACPI_ROOT_OBJECT;
+
+	if (len == ACPI_PATHNAME_MAX)
+		return NULL;
+
+	new_path = dev_acpi_parse_path(path);
+
+	if (!new_path)
+		return NULL;
 
 	status = acpi_get_handle(NULL, new_path, &handle);
 	kfree(new_path);
 
-	return ACPI_SUCCESS(status) ? handle : NULL;
+	if (ACPI_FAILURE(status))
+		return NULL;
+
+	return handle;
+}
+
+/*
+ * Handle IDs are indexes (+ 1) into a per open table.  The path is kept
+ * so the handle can be looked up again if the namespace changes.
+ */
+static int
+dev_acpi_id_open(
+	priv_data_t	*priv,
+	char		*path)
+{
+	acpi_handle	handle;
+	int		i;
+
+	handle = dev_acpi_get_handle(path);
+	if (!handle)
+		return -ENOENT;
+
+	down(&priv->ids_sem);
+
+	if (!priv->ids) {
+		priv->ids = kmalloc(HANDLE_IDS_MAX * sizeof(*priv->ids),
+		                    GFP_KERNEL);
+		if (!priv->ids) {
+			up(&priv->ids_sem);
+			return -ENOMEM;
+		}
+
+		memset(priv->ids, 0, HANDLE_IDS_MAX * sizeof(*priv->ids));
+	}
+
+	for (i = 0 ; i < HANDLE_IDS_MAX ; i++)
+		if (!priv->ids[i].pathname)
+			break;
+
+	if (i == HANDLE_IDS_MAX) {
+		up(&priv->ids_sem);
+		return -ENOSPC;
+	}
+
+	priv->ids[i].pathname = strdup(path);
+	if (!priv->ids[i].pathname) {
+		up(&priv->ids_sem);
+		return -ENOMEM;
+	}
+
+	priv->ids[i].handle = handle;
+	priv->ids[i].generation = atomic_read(&ns_generation);
+
+	up(&priv->ids_sem);
+	return i + 1;
+}
+
+static int
+dev_acpi_id_close(
+	priv_data_t	*priv,
+	u32		id)
+{
+	down(&priv->ids_sem);
+
+	if (!id || id > HANDLE_IDS_MAX || !priv->ids ||
+	    !priv->ids[id - 1].pathname) {
+		up(&priv->ids_sem);
+		return -EINVAL;
+	}
+
+	kfree(priv->ids[id - 1].pathname);
+	priv->ids[id - 1].pathname = NULL;
+
+	up(&priv->ids_sem);
+	return 0;
+}
+
+/* Given a handle ID and optional relative path, try to get an ACPI handle */
+static acpi_handle
+dev_acpi_id_handle(
+	priv_data_t	*priv,
+	u32		id,
+	char		*name,
+	size_t		name_len)
+{
+	struct handle_id	*hid;
+	acpi_handle		handle, child;
+	u32			gen;
+
+	if (!id || id > HANDLE_IDS_MAX)
+		return NULL;
+
+	down(&priv->ids_sem);
+
+	hid = priv->ids ? &priv->ids[id - 1] : NULL;
+	if (!hid || !hid->pathname) {
+		up(&priv->ids_sem);
+		return NULL;
+	}
+
+	gen = atomic_read(&ns_generation);
+	if (!dev_acpi_ns_current(hid->generation)) {
+		handle = dev_acpi_get_handle(hid->pathname);
+		if (!handle) {
+			up(&priv->ids_sem);
+			return NULL;
+		}
+
+		hid->handle = handle;
+		hid->generation = gen;
+	}
+	handle = hid->handle;
+
+	up(&priv->ids_sem);
+
+	if (!name[0])
+		return handle;
+
+	name[name_len - 1] = '\0';
+
+	if (ACPI_FAILURE(acpi_get_handle(handle, name, &child)))
+		return NULL;
+
+	return child;
+}
+
+#ifdef ACPI_TABLE_EVENT_LOAD
+/* Tables loaded or unloaded, cached handles may no longer be valid */
+static acpi_status
+dev_acpi_table_event(
+	u32	event,
+	void	*table,
+	void	*context)
+{
+	dev_acpi_ns_changed();
+	return AE_OK;
 }
+#endif
 
 /* Return a buffer of object below a given handle */
 static acpi_status
@@ -375,21 +1360,13 @@ dev_acpi_get_next(
 	struct acpi_buffer	*buffer)
 {
 	acpi_handle		chandle;
-	size_t			new_size;
-	char			*new_buf, pathname[ACPI_PATHNAME_MAX];
+	result_buf_t		rb = {NULL, 0, 0};
+	char			pathname[ACPI_PATHNAME_MAX];
 	struct acpi_buffer	path_buf = {ACPI_PATHNAME_MAX, pathname};
 
 	if (buffer->length || buffer->pointer)
 		return AE_ALREADY_EXISTS;
 
-	/* Setup the string terminator, then just push it along */
-	buffer->pointer = kmalloc(1, GFP_KERNEL);
-	if (!buffer->pointer)
-		return AE_NO_MEMORY;
-
-	buffer->length = 1;
-	memset(buffer->pointer, 0, 1);
-
 	chandle = NULL;
 
 	while (ACPI_SUCCESS(acpi_get_next_object(ACPI_TYPE_ANY, handle,
@@ -402,390 +1379,3440 @@ dev_acpi_get_next(
 		                               &path_buf)))
 			continue;
 
-		/*
-		 * length includes terminator, which we'll replace
-		 * with a line feed.
-		 */
-		new_size = buffer->length + path_buf.length;
-		new_buf = kmalloc(new_size, GFP_KERNEL);
-
-		if (!new_buf) {
-			kfree(buffer->pointer);
-			buffer->pointer = NULL;
-			buffer->length = 0;
+		if (!result_buf_append_line(&rb, pathname)) {
+			result_buf_free(&rb);
 			return AE_NO_MEMORY;
 		}
-
-		memset(new_buf, 0, new_size);
-
-		sprintf(new_buf, "%s%s\n", (char *)buffer->pointer, pathname);
-
-		kfree(buffer->pointer);
-
-		buffer->pointer = new_buf;
-		buffer->length = new_size;
 	}
 
 	/* if nothing found, return nothing */
-	if (buffer->length == 1) {
-		kfree(buffer->pointer);
-		buffer->pointer = NULL;
-		buffer->length = 0;
-	}
+	if (!result_buf_finish(&rb, buffer, 1))
+		return AE_NO_MEMORY;
 
 	return AE_OK;
 }
 
+/* Same as above, but as dev_acpi_node_t records including type */
 static acpi_status
-dev_acpi_get_devices_callback(
-	acpi_handle	handle,
-	u32		depth,
-	void		*context,
-	void		**ret)
+dev_acpi_get_next_nodes(
+	acpi_handle		handle,
+	struct acpi_buffer	*buffer)
 {
-	struct acpi_buffer	*ret_buf;
-	acpi_status		status;
-	size_t			new_size;
-	char			*new_buf, pathname[ACPI_PATHNAME_MAX];
-	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, pathname};
+	acpi_handle		chandle, gchandle;
+	acpi_object_type	type;
+	dev_acpi_node_t		node;
+	result_buf_t		rb = {NULL, 0, 0};
+	char			name[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	name_buf = {ACPI_PATHNAME_MAX, name};
 
-	ret_buf = *ret;
+	if (buffer->length || buffer->pointer)
+		return AE_ALREADY_EXISTS;
 
-	memset(pathname, 0, sizeof(pathname));
-	status = acpi_get_name(handle, ACPI_FULL_PATHNAME, &buffer);
+	chandle = NULL;
 
-	if (ACPI_FAILURE(status))
-		return status;
+	while (ACPI_SUCCESS(acpi_get_next_object(ACPI_TYPE_ANY, handle,
+	                                         chandle, &chandle))) {
 
-	/*
-	 * length includes terminator, which we'll replace
-	 * with a line feed.
-	 */
-	new_size = buffer.length + ret_buf->length;
-	new_buf = kmalloc(new_size, GFP_KERNEL);
+		name_buf.length = sizeof(name);
+		memset(name, 0, sizeof(name));
 
-	if (!new_buf)
+		if (ACPI_FAILURE(acpi_get_name(chandle, ACPI_SINGLE_NAME,
+		                               &name_buf)))
+			continue;
+
+		if (ACPI_FAILURE(acpi_get_type(chandle, &type)))
+			type = ACPI_TYPE_NOT_FOUND;
+
+		memset(&node, 0, sizeof(node));
+		memcpy(node.name, name, sizeof(node.name));
+		node.type = type;
+
+		gchandle = NULL;
+		while (ACPI_SUCCESS(acpi_get_next_object(ACPI_TYPE_ANY,
+		                                         chandle, gchandle,
+		                                         &gchandle)))
+			node.children++;
+
+		if (!result_buf_append(&rb, &node, sizeof(node))) {
+			result_buf_free(&rb);
+			return AE_NO_MEMORY;
+		}
+	}
+
+	if (!result_buf_finish(&rb, buffer, 0))
 		return AE_NO_MEMORY;
 
-	memset(new_buf, 0, new_size);
+	return AE_OK;
+}
+
+/*
+ * Namespace paths are limited to ACPI_PATHNAME_MAX, so nothing we could
+ * name is deeper than this.
+ */
+#define SUBTREE_DEPTH_MAX	(ACPI_PATHNAME_MAX / 4)
+
+struct subtree_walk {
+	result_buf_t	rb;
+	u32		count;
+	u32		parents[SUBTREE_DEPTH_MAX + 1];	/* index by depth */
+};
+
+static int
+dev_acpi_subtree_add(
+	struct subtree_walk	*walk,
+	acpi_handle		handle,
+	u32			depth)
+{
+	dev_acpi_subtree_node_t	node;
+	acpi_object_type	type;
+	char			name[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	name_buf = {ACPI_PATHNAME_MAX, name};
+
+	memset(name, 0, sizeof(name));
+	memset(&node, 0, sizeof(node));
+
+	if (ACPI_SUCCESS(acpi_get_name(handle, ACPI_SINGLE_NAME, &name_buf)))
+		memcpy(node.name, name, sizeof(node.name));
+
+	if (ACPI_FAILURE(acpi_get_type(handle, &type)))
+		type = ACPI_TYPE_NOT_FOUND;
+
+	node.type = type;
+	node.depth = depth;
+	node.parent = depth ? walk->parents[depth - 1] : DEV_ACPI_NO_PARENT;
+
+	if (!result_buf_append(&walk->rb, &node, sizeof(node)))
+		return 0;
 
-	sprintf(new_buf, "%s%s\n", (char *)ret_buf->pointer, pathname);
+	walk->parents[depth] = walk->count++;
+	return 1;
+}
 
-	kfree(ret_buf->pointer);
+static acpi_status
+dev_acpi_get_subtree_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	struct subtree_walk *walk = *ret;
 
-	ret_buf->pointer = new_buf;
-	ret_buf->length = new_size;
+	if (!dev_acpi_subtree_add(walk, handle, depth))
+		return AE_NO_MEMORY;
 
 	return AE_OK;
 }
 
+/* Preorder dev_acpi_subtree_node_t records for handle and everything below */
 static acpi_status
-dev_acpi_get_devices(char *hid, struct acpi_buffer *buffer)
+dev_acpi_get_subtree(
+	acpi_handle		handle,
+	struct acpi_buffer	*buffer)
 {
-	acpi_status	status;
+	struct subtree_walk	*walk;
+	acpi_status		status;
 
 	if (buffer->length || buffer->pointer)
 		return AE_ALREADY_EXISTS;
 
-	/* Setup the string terminator, then just push it along */
-	buffer->pointer = kmalloc(1, GFP_KERNEL);
-	if (!buffer->pointer)
+	walk = kmalloc(sizeof(*walk), GFP_KERNEL);
+
+	if (!walk)
 		return AE_NO_MEMORY;
 
-	buffer->length = 1;
-	memset(buffer->pointer, 0, 1);
+	memset(walk, 0, sizeof(*walk));
 
-	status = acpi_get_devices(hid, dev_acpi_get_devices_callback,
-	                          NULL, (void **)&buffer);
-	
-	if (ACPI_FAILURE(status) || buffer->length == 1) {
-		kfree(buffer->pointer);
-		buffer->length = 0;
-		buffer->pointer = NULL;
-		if (buffer->length == 1)
-			status = AE_NOT_FOUND;
+	if (!dev_acpi_subtree_add(walk, handle, 0)) {
+		status = AE_NO_MEMORY;
+		goto out;
 	}
+
+	status = acpi_walk_namespace(ACPI_TYPE_ANY, handle, SUBTREE_DEPTH_MAX,
+	                             dev_acpi_get_subtree_callback,
+	                             NULL, (void **)&walk);
+
+	if (ACPI_FAILURE(status))
+		goto out;
+
+	if (!result_buf_finish(&walk->rb, buffer, 0))
+		status = AE_NO_MEMORY;
+ out:
+	if (ACPI_FAILURE(status))
+		result_buf_free(&walk->rb);
+	kfree(walk);
 	return status;
 }
 
-static acpi_status
-dev_acpi_get_objects_callback(
+static struct list_head *
+hid_index_bucket(char *id)
+{
+	return &hid_index[jhash(id, strlen(id), 0) & (HID_INDEX_BUCKETS - 1)];
+}
+
+static void
+hid_index_free(void)
+{
+	struct hid_index_entry	*entry;
+	struct list_head	*node, *tmp;
+	int			i;
+
+	for (i = 0 ; i < HID_INDEX_BUCKETS ; i++) {
+		list_for_each_safe(node, tmp, &hid_index[i]) {
+			entry = list_entry(node, struct hid_index_entry, node);
+			list_del(&entry->node);
+			kfree(entry);
+		}
+	}
+	hid_index_valid = 0;
+}
+
+static int
+hid_index_add(
+	acpi_handle		handle,
+	char			*id,
+	struct acpi_device_info	*info)
+{
+	struct hid_index_entry *entry;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+
+	if (!entry)
+		return 0;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->handle = handle;
+	strncpy(entry->id, id, sizeof(entry->id) - 1);
+
+	if (info->valid & ACPI_VALID_UID)
+		strncpy(entry->uid, info->unique_id.value,
+		        min(sizeof(entry->uid), sizeof(info->unique_id.value))
+		        - 1);
+
+	list_add_tail(&entry->node, hid_index_bucket(entry->id));
+	return 1;
+}
+
+static acpi_status
+hid_index_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	struct acpi_buffer		buffer = {ACPI_ALLOCATE_BUFFER, NULL};
+	struct acpi_device_info		*info;
+	struct acpi_compatible_id_list	*cids;
+	u32				i, j;
+
+	if (ACPI_FAILURE(acpi_get_object_info(handle, &buffer)))
+		return AE_CTRL_DEPTH;
+
+	info = buffer.pointer;
+
+	if ((info->valid & ACPI_VALID_HID) &&
+	    !hid_index_add(handle, info->hardware_id.value, info))
+		goto nomem;
+
+	if (!(info->valid & ACPI_VALID_CID))
+		goto out;
+
+	cids = &info->compatibility_id;
+
+	for (i = 0 ; i < cids->count ; i++) {
+
+		/* a device is only listed once per ID */
+		if ((info->valid & ACPI_VALID_HID) &&
+		    !strcmp(cids->id[i].value, info->hardware_id.value))
+			continue;
+
+		for (j = 0 ; j < i ; j++)
+			if (!strcmp(cids->id[i].value, cids->id[j].value))
+				break;
+		if (j < i)
+			continue;
+
+		if (!hid_index_add(handle, cids->id[i].value, info))
+			goto nomem;
+	}
+ out:
+	kfree(info);
+	return AE_OK;
+ nomem:
+	kfree(info);
+	return AE_NO_MEMORY;
+}
+
+/* Called with hid_index_sem held */
+static int
+hid_index_rebuild(void)
+{
+	u32 gen = atomic_read(&ns_generation);
+
+	hid_index_free();
+
+	if (ACPI_FAILURE(acpi_walk_namespace(ACPI_TYPE_DEVICE,
+	                                     ACPI_ROOT_OBJECT, ACPI_UINT32_MAX,
+	                                     hid_index_callback, NULL, NULL))) {
+		hid_index_free();
+		return 0;
+	}
+
+	hid_index_valid = 1;
+	hid_index_generation = gen;
+	hid_index_rebuilds++;
+	return 1;
+}
+
+/* A device's _STA, 0x0f if it has none, 0 if it fails */
+static u32
+dev_acpi_sta(acpi_handle handle)
+{
+	union acpi_object	obj;
+	struct acpi_buffer	buffer = {sizeof(obj), &obj};
+	acpi_status		status;
+
+	status = acpi_evaluate_object(handle, "_STA", NULL, &buffer);
+
+	if (status == AE_NOT_FOUND)
+		return 0x0f;
+
+	if (ACPI_FAILURE(status) || obj.type != ACPI_TYPE_INTEGER)
+		return 0;
+
+	return obj.integer.value;
+}
+
+/*
+ * Is a device present right now?  Same rules as acpi_get_devices(), a
+ * device below an absent one is absent too.  The device's own _STA is
+ * returned in sta.
+ */
+static int
+dev_acpi_present(acpi_handle handle, u32 *sta)
+{
+	acpi_object_type type;
+
+	*sta = dev_acpi_sta(handle);
+
+	if (!(*sta & 0x01))
+		return 0;
+
+	while (ACPI_SUCCESS(acpi_get_parent(handle, &handle))) {
+		if (ACPI_FAILURE(acpi_get_type(handle, &type)))
+			return 0;
+
+		if (type == ACPI_TYPE_DEVICE && !(dev_acpi_sta(handle) & 0x01))
+			return 0;
+	}
+	return 1;
+}
+
+struct get_devices_ctx {
+	result_buf_t	rb;
+	int		ext;
+};
+
+static acpi_status
+dev_acpi_get_devices_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	struct get_devices_ctx	*ctx = context;
+	struct acpi_buffer	info_buf = {ACPI_ALLOCATE_BUFFER, NULL};
+	struct acpi_device_info	*info;
+	acpi_status		status;
+	char			pathname[ACPI_PATHNAME_MAX];
+	char			line[ACPI_PATHNAME_MAX + ACPI_MAX_CID_LENGTH + 16];
+	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, pathname};
+
+	memset(pathname, 0, sizeof(pathname));
+	status = acpi_get_name(handle, ACPI_FULL_PATHNAME, &buffer);
+
+	if (ACPI_FAILURE(status))
+		return status;
+
+	if (!ctx->ext)
+		strcpy(line, pathname);
+	else if (ACPI_SUCCESS(acpi_get_object_info(handle, &info_buf))) {
+		info = info_buf.pointer;
+		snprintf(line, sizeof(line), "%s,%s,%08x", pathname,
+		         (info->valid & ACPI_VALID_UID) ?
+		         info->unique_id.value : "",
+		         (info->valid & ACPI_VALID_STA) ?
+		         info->current_status : 0x0f);
+		kfree(info);
+	} else
+		snprintf(line, sizeof(line), "%s,,%08x", pathname,
+		         dev_acpi_sta(handle));
+
+	if (!result_buf_append_line(&ctx->rb, line))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * dev_acpi_get_devices() without the index, for when nothing tells us
+ * the namespace changed.  acpi_get_devices() checks _STA itself.
+ */
+static acpi_status
+dev_acpi_get_devices_walk(char *hid, struct acpi_buffer *buffer, int ext)
+{
+	struct get_devices_ctx	ctx = {{NULL, 0, 0}, ext};
+	acpi_status		status;
+
+	status = acpi_get_devices(hid, dev_acpi_get_devices_callback,
+	                          &ctx, NULL);
+
+	if (ACPI_FAILURE(status)) {
+		result_buf_free(&ctx.rb);
+		return status;
+	}
+
+	if (!result_buf_finish(&ctx.rb, buffer, 1))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * Devices with a given _HID or _CID, one path per line.  With ext set
+ * each line also carries the device's _UID and _STA.  The index is only
+ * used while the namespace generation is tracked.
+ */
+static acpi_status
+dev_acpi_get_devices(char *hid, struct acpi_buffer *buffer, int ext)
+{
+	struct hid_index_entry	*entry;
+	struct list_head	*node;
+	result_buf_t		rb = {NULL, 0, 0};
+	char			pathname[ACPI_PATHNAME_MAX];
+	char			line[ACPI_PATHNAME_MAX + ACPI_MAX_CID_LENGTH + 16];
+	struct acpi_buffer	path_buf = {ACPI_PATHNAME_MAX, pathname};
+	u32			sta;
+
+	if (buffer->length || buffer->pointer)
+		return AE_ALREADY_EXISTS;
+
+	if (strnlen(hid, ACPI_MAX_CID_LENGTH) == ACPI_MAX_CID_LENGTH)
+		return AE_OK;
+
+	if (!ns_tracked)
+		return dev_acpi_get_devices_walk(hid, buffer, ext);
+
+	down(&hid_index_sem);
+
+	if (!hid_index_valid || !dev_acpi_ns_current(hid_index_generation)) {
+		if (!hid_index_rebuild()) {
+			up(&hid_index_sem);
+			return AE_NO_MEMORY;
+		}
+	}
+
+	list_for_each(node, hid_index_bucket(hid)) {
+		entry = list_entry(node, struct hid_index_entry, node);
+
+		if (strcmp(entry->id, hid))
+			continue;
+
+		if (!dev_acpi_present(entry->handle, &sta))
+			continue;
+
+		memset(pathname, 0, sizeof(pathname));
+		path_buf.length = sizeof(pathname);
+
+		if (ACPI_FAILURE(acpi_get_name(entry->handle,
+		                               ACPI_FULL_PATHNAME, &path_buf)))
+			continue;
+
+		if (ext)
+			snprintf(line, sizeof(line), "%s,%s,%08x", pathname,
+			         entry->uid, sta);
+		else
+			strcpy(line, pathname);
+
+		if (!result_buf_append_line(&rb, line)) {
+			up(&hid_index_sem);
+			result_buf_free(&rb);
+			return AE_NO_MEMORY;
+		}
+	}
+
+	up(&hid_index_sem);
+
+	if (!result_buf_finish(&rb, buffer, 1))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * _HID, _CID, _UID, _ADR and _STA of an object as one fixed record,
+ * ACPI CA evaluates them all in a single acpi_get_object_info().
+ */
+static acpi_status
+dev_acpi_get_device_info(acpi_handle handle, struct acpi_buffer *buffer)
+{
+	struct acpi_buffer		info_buf = {ACPI_ALLOCATE_BUFFER, NULL};
+	struct acpi_device_info		*info;
+	struct acpi_compatible_id_list	*cids;
+	dev_acpi_device_info_t		*rec;
+	acpi_status			status;
+	u32				i;
+
+	if (buffer->length || buffer->pointer)
+		return AE_ALREADY_EXISTS;
+
+	status = acpi_get_object_info(handle, &info_buf);
+
+	if (ACPI_FAILURE(status))
+		return status;
+
+	info = info_buf.pointer;
+
+	rec = kmalloc(sizeof(*rec), GFP_KERNEL);
+
+	if (!rec) {
+		kfree(info);
+		return AE_NO_MEMORY;
+	}
+
+	memset(rec, 0, sizeof(*rec));
+
+	memcpy(rec->name, &info->name, sizeof(rec->name));
+	rec->type = info->type;
+	rec->valid = info->valid;
+
+	if (info->valid & ACPI_VALID_STA)
+		rec->sta = info->current_status;
+
+	if (info->valid & ACPI_VALID_ADR)
+		rec->adr = info->address;
+
+	if (info->valid & ACPI_VALID_HID)
+		strncpy(rec->hid, info->hardware_id.value,
+		        sizeof(rec->hid) - 1);
+
+	if (info->valid & ACPI_VALID_UID)
+		strncpy(rec->uid, info->unique_id.value,
+		        sizeof(rec->uid) - 1);
+
+	if (info->valid & ACPI_VALID_CID) {
+		cids = &info->compatibility_id;
+		rec->cid_count = cids->count;
+
+		for (i = 0 ; i < cids->count && i < DEV_ACPI_INFO_CIDS ; i++)
+			strncpy(rec->cid[i], cids->id[i].value,
+			        sizeof(rec->cid[i]) - 1);
+	}
+
+	kfree(info);
+
+	buffer->pointer = rec;
+	buffer->length = sizeof(*rec);
+	return AE_OK;
+}
+
+static u32
+name_index_hash(u32 name)
+{
+	return jhash_1word(name, 0) & (NAME_INDEX_BUCKETS - 1);
+}
+
+static acpi_status
+name_index_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	struct name_index_entry	*entry;
+	char			name[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, name};
+
+	/* Counting pass */
+	if (!name_index) {
+		name_index_count++;
+		return AE_OK;
+	}
+
+	/* Namespace grew between the passes, the next rebuild picks it up */
+	if (name_index_count == name_index_size)
+		return AE_CTRL_TERMINATE;
+
+	memset(name, 0, sizeof(name));
+
+	if (ACPI_FAILURE(acpi_get_name(handle, ACPI_SINGLE_NAME, &buffer)))
+		return AE_OK;
+
+	entry = &name_index[name_index_count++];
+	memcpy(&entry->name, name, sizeof(entry->name));
+	entry->handle = handle;
+
+	return AE_OK;
+}
+
+/* Called with name_index_sem held */
+static int
+name_index_rebuild(void)
+{
+	acpi_status	status;
+	u32		gen, i, bucket;
+
+	gen = atomic_read(&ns_generation);
+
+	vfree(name_index);
+	name_index = NULL;
+	name_index_count = 0;
+
+	status = acpi_walk_namespace(ACPI_TYPE_ANY, ACPI_ROOT_OBJECT,
+	                             ACPI_UINT32_MAX, name_index_callback,
+	                             NULL, NULL);
+
+	if (ACPI_FAILURE(status))
+		return 0;
+
+	name_index_size = name_index_count;
+	name_index = vmalloc((name_index_size ? : 1) * sizeof(*name_index));
+
+	if (!name_index)
+		return 0;
+
+	name_index_count = 0;
+
+	status = acpi_walk_namespace(ACPI_TYPE_ANY, ACPI_ROOT_OBJECT,
+	                             ACPI_UINT32_MAX, name_index_callback,
+	                             NULL, NULL);
+
+	if (ACPI_FAILURE(status)) {
+		vfree(name_index);
+		name_index = NULL;
+		return 0;
+	}
+
+	/* Link back to front so each chain stays in walk order */
+	for (i = 0 ; i < NAME_INDEX_BUCKETS ; i++)
+		name_index_buckets[i] = NAME_INDEX_END;
+
+	for (i = name_index_count ; i-- > 0 ; ) {
+		bucket = name_index_hash(name_index[i].name);
+		name_index[i].next = name_index_buckets[bucket];
+		name_index_buckets[bucket] = i;
+	}
+
+	name_index_generation = gen;
+	name_index_rebuilds++;
+	return 1;
+}
+
+static acpi_status
+dev_acpi_get_objects_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	result_buf_t		*rb;
+	acpi_status		status;
+	char			*name, pathname[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, pathname};
+
+	rb = *ret;
+
+	memset(pathname, 0, sizeof(pathname));
+
+	name = (char *)context;
+
+	/*
+	 * First get the single name to see if this is what we're looking
+	 * for.  If it is, get the full path.
+	 */
+	status = acpi_get_name(handle, ACPI_SINGLE_NAME, &buffer);
+
+	if (ACPI_FAILURE(status))
+		return status;
+
+	if (strcmp(name, pathname))
+		return AE_OK; /* Not it */
+
+	memset(pathname, 0, sizeof(pathname));
+	buffer.length = sizeof(pathname);
+
+	status = acpi_get_name(handle, ACPI_FULL_PATHNAME, &buffer);
+
+	if (ACPI_FAILURE(status))
+		return status;
+
+	if (!result_buf_append_line(rb, pathname))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * dev_acpi_get_objects() without the index, for when nothing tells us
+ * the namespace changed.  One walk per lookup.
+ */
+static acpi_status
+dev_acpi_get_objects_walk(char *name, struct acpi_buffer *buffer)
+{
+	acpi_status	status;
+	result_buf_t	rb = {NULL, 0, 0};
+	result_buf_t	*rbp = &rb;
+
+	status = acpi_walk_namespace(ACPI_TYPE_ANY,
+	                             ACPI_ROOT_OBJECT,
+	                             ACPI_UINT32_MAX,
+	                             dev_acpi_get_objects_callback,
+	                             (void *)name,
+	                             (void **)&rbp);
+
+	if (ACPI_FAILURE(status)) {
+		result_buf_free(&rb);
+		return status;
+	}
+
+	if (!result_buf_finish(&rb, buffer, 1))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * Objects with a given single name, one path per line.  The index is
+ * only used while the namespace generation is tracked.
+ */
+static acpi_status
+dev_acpi_get_objects(char *name, struct acpi_buffer *buffer)
+{
+	result_buf_t		rb = {NULL, 0, 0};
+	char			pathname[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	path_buf = {ACPI_PATHNAME_MAX, pathname};
+	u32			seg, i;
+
+	if (buffer->length || buffer->pointer)
+		return AE_ALREADY_EXISTS;
+
+	/* Single names are always 4 characters, nothing else can match */
+	if (strnlen(name, ACPI_PATHNAME_MAX) != sizeof(seg))
+		return AE_OK;
+
+	if (!ns_tracked)
+		return dev_acpi_get_objects_walk(name, buffer);
+
+	memcpy(&seg, name, sizeof(seg));
+
+	down(&name_index_sem);
+
+	if (!name_index || !dev_acpi_ns_current(name_index_generation)) {
+		if (!name_index_rebuild()) {
+			up(&name_index_sem);
+			return AE_NO_MEMORY;
+		}
+	}
+
+	for (i = name_index_buckets[name_index_hash(seg)] ;
+	     i != NAME_INDEX_END ; i = name_index[i].next) {
+
+		if (name_index[i].name != seg)
+			continue;
+
+		memset(pathname, 0, sizeof(pathname));
+		path_buf.length = sizeof(pathname);
+
+		if (ACPI_FAILURE(acpi_get_name(name_index[i].handle,
+		                               ACPI_FULL_PATHNAME, &path_buf)))
+			continue;
+
+		if (!result_buf_append_line(&rb, pathname)) {
+			up(&name_index_sem);
+			result_buf_free(&rb);
+			return AE_NO_MEMORY;
+		}
+	}
+
+	up(&name_index_sem);
+
+	if (!result_buf_finish(&rb, buffer, 1))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * Drain as many queued events as fit in the user buffer
+ */
+static ssize_t
+dev_acpi_read_events(
+	priv_data_t	*priv,
+	char __user	*buf,
+	size_t		len)
+{
+	char		line[EVENT_LINE_MAX];
+	size_t		done;
+	int		size;
+
+	for (done = 0 ; done < len ; done += size) {
+		size = dev_acpi_event_pop(priv, line, len - done);
+		if (size <= 0) {
+			if (!done)
+				return size;
+			break;
+		}
+
+		if (copy_to_user(buf + done, line, size))
+			return done ? done : -EFAULT;
+	}
+	return done;
+}
+
+/* Notifiers or value change samplers may queue events */
+static int
+dev_acpi_has_events(priv_data_t *priv)
+{
+	return !list_empty(&priv->notify) || priv->change_samplers;
+}
+
+static ssize_t
+dev_acpi_read_ctx(
+	struct file	*f,
+	struct file_ctx	*ctx,
+	char __user	*buf,
+	size_t		len,
+	loff_t		*off)
+{
+	unsigned char		*copy_addr;
+	size_t			copy_len;
+	struct acpi_buffer	*buffer;
+	priv_data_t		*priv;
+
+	priv = (priv_data_t *)f->private_data;
+	buffer = &ctx->read;
+
+	/* threads have their own position, the file offset is shared */
+	if (ctx != &priv->shared)
+		off = &ctx->pos;
+
+	/*
+	 * Results are read from the file offset, each new result starts
+	 * back at 0.  Without notifiers the result can be read (or pread)
+	 * as often as the caller likes.  With notifiers installed, hand
+	 * out the rest of a result that hasn't been read yet, otherwise
+	 * queued events, and let the reader wait if there's neither.
+	 */
+	while (!ctx->ready) {
+		if (!dev_acpi_has_events(priv)) {
+			if (!buffer->length || !buffer->pointer)
+				return -ENODEV;
+			break;
+		}
+
+		if (priv->ev_count)
+			return dev_acpi_read_events(priv, buf, len);
+
+		if (f->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+
+		if (wait_event_interruptible(priv->wait, ctx->ready ||
+		                             priv->ev_count ||
+		                             !dev_acpi_has_events(priv)))
+			return -ERESTARTSYS;
+	}
+
+	/* not held while waiting, ioctls may be what we're waiting for */
+	if (ctx == &priv->shared && down_interruptible(&priv->shared_sem))
+		return -ERESTARTSYS;
+
+	if (*off >= buffer->length) {
+		copy_len = 0;
+		goto out;
+	}
+
+	copy_addr = buffer->pointer + *off;
+	copy_len = min((size_t)(buffer->length - *off), len);
+
+	if (copy_to_user(buf, copy_addr, copy_len)) {
+		copy_len = -EFAULT;
+		goto unlock;
+	}
+
+	*off += copy_len;
+ out:
+	/* the whole result has been seen, go back to events */
+	if (*off >= buffer->length) {
+		spin_lock(&priv->lock);
+		ctx->ready = 0;
+		spin_unlock(&priv->lock);
+	}
+ unlock:
+	if (ctx == &priv->shared)
+		up(&priv->shared_sem);
+
+	return copy_len;
+}
+
+static ssize_t
+dev_acpi_read(
+	struct file	*f,
+	char __user	*buf,
+	size_t		len,
+	loff_t		*off)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+	struct file_ctx	*ctx;
+	ssize_t		ret;
+
+	/* the shared context is locked only around the copy */
+	if (!priv->per_thread)
+		return dev_acpi_read_ctx(f, &priv->shared, buf, len, off);
+
+	ctx = dev_acpi_ctx_get(f);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	ret = dev_acpi_read_ctx(f, ctx, buf, len, off);
+
+	dev_acpi_ctx_put(f, ctx);
+	return ret;
+}
+
+static ssize_t
+dev_acpi_write(
+	struct file		*f,
+	const char __user	*buf,
+	size_t			len,
+	loff_t			*off)
+{
+	struct acpi_buffer	*buffer;
+	struct file_ctx		*ctx;
+	void			*new_buf = NULL;
+
+	/*
+	 * The file offset belongs to the read side.  Each write replaces
+	 * the write buffer, so arguments an ioctl didn't consume can't end
+	 * up in front of the next ones.
+	 */
+	if (len) {
+		new_buf = kmalloc(len, GFP_KERNEL);
+
+		if (!new_buf)
+			return -ENOMEM;
+
+		if (copy_from_user(new_buf, buf, len)) {
+			kfree(new_buf);
+			return -EFAULT;
+		}
+	}
+
+	ctx = dev_acpi_ctx_get(f);
+	if (IS_ERR(ctx)) {
+		kfree(new_buf);
+		return PTR_ERR(ctx);
+	}
+
+	buffer = &ctx->write;
+
+	kfree(buffer->pointer);
+	buffer->pointer = new_buf;
+	buffer->length = len;
+
+	dev_acpi_ctx_put(f, ctx);
+	return len;
+}
+
+/*
+ * The last event queued for a subscription if it's still waiting to be
+ * read.  Called with the file's lock held.
+ */
+static struct event_rec *
+dev_acpi_last_event(struct notify_list *entry)
+{
+	priv_data_t		*priv = entry->priv;
+	struct event_rec	*rec;
+	u32			age;
+
+	age = priv->ev_seq - entry->last_seq;
+
+	if (!age || age > priv->ev_count)
+		return NULL;
+
+	rec = &priv->events[(priv->ev_head + priv->ev_count - age) %
+	                    priv->ev_depth];
+
+	return rec->sub == entry ? rec : NULL;
+}
+
+/*
+ * Queue an event for one subscription.  Events not in the mask are
+ * dropped, a repeat of the last queued event within the window only
+ * bumps its count and doesn't wake anyone.
+ */
+static void
+dev_acpi_queue_event(
+	struct notify_list	*entry,
+	u32			event,
+	u64			timestamp)
+{
+	priv_data_t		*priv = entry->priv;
+	struct event_rec	*rec;
+
+	spin_lock(&priv->lock);
+
+	if (entry->dead) {
+		spin_unlock(&priv->lock);
+		return;
+	}
+
+	if (event < DEV_ACPI_EVENT_MASK_WORDS * 32 &&
+	    !(entry->mask[event / 32] & (1U << (event % 32)))) {
+		entry->filtered++;
+		spin_unlock(&priv->lock);
+		return;
+	}
+
+	if (entry->window_ms) {
+		rec = dev_acpi_last_event(entry);
+
+		if (rec && rec->event == event && timestamp - rec->timestamp <
+		                                  entry->window_ms * 1000000ULL) {
+			rec->count++;
+			entry->coalesced++;
+			spin_unlock(&priv->lock);
+			return;
+		}
+	}
+
+	if (priv->ev_count == priv->ev_depth) {
+		priv->ev_overflows++;
+		entry->overflows++;
+		spin_unlock(&priv->lock);
+		return;
+	}
+
+	rec = &priv->events[(priv->ev_head + priv->ev_count) % priv->ev_depth];
+	memset(rec, 0, sizeof(*rec));
+	rec->sub = entry;
+	rec->id = entry->id;
+	rec->event = event;
+	rec->timestamp = timestamp;
+	rec->count = 1;
+	priv->ev_count++;
+	entry->last_seq = ++priv->ev_seq;
+	entry->delivered++;
+
+	spin_unlock(&priv->lock);
+
+	wake_up_interruptible(&priv->wait);
+}
+
+/*
+ * Called once per event for all subscribers, no lookups or allocations,
+ * the pathname is only needed when a text reader formats the event.
+ */
+static void
+dev_acpi_notify(
+	acpi_handle	handle,
+	u32		event,
+	void		*data)
+{
+	struct notify_source	*source;
+	struct notify_list	*entry;
+	struct list_head	*node;
+	u64			timestamp;
+	
+	timestamp = dev_acpi_now();
+	source = (struct notify_source *)data;
+
+	/* devices may have come or gone below this one */
+	if (event == ACPI_NOTIFY_BUS_CHECK ||
+	    event == ACPI_NOTIFY_DEVICE_CHECK ||
+	    event == ACPI_NOTIFY_EJECT_REQUEST)
+		dev_acpi_ns_changed();
+
+	rcu_read_lock();
+	list_for_each_rcu(node, &source->subs) {
+		entry = list_entry(node, struct notify_list, sub);
+		dev_acpi_queue_event(entry, event, timestamp);
+	}
+	rcu_read_unlock();
+}
+
+static struct list_head *
+notify_source_bucket(
+	acpi_handle	device,
+	u32		type)
+{
+	return &notify_sources[jhash_2words((u32)(unsigned long)device, type,
+	                                    0) & (NOTIFY_SOURCE_BUCKETS - 1)];
+}
+
+static struct notify_list *
+dev_acpi_notify_find(
+	priv_data_t	*priv,
+	acpi_handle	handle,
+	u32		type)
+{
+	struct notify_list	*entry;
+	struct list_head	*node;
+
+	list_for_each(node, &priv->notify) {
+		entry = list_entry(node, struct notify_list, node);
+
+		if (entry->device == handle && entry->type == type)
+			return entry;
+	}
+	return NULL;
+}
+
+/*
+ * Source for handle and type, installing the ACPI CA handler if this
+ * is the first subscriber.  A source left over from earlier subscribers
+ * is reused, its pathname is looked up again in case the handle now
+ * names a different object.  Called with notify_sem held.
+ */
+static int
+notify_source_get(
+	acpi_handle		handle,
+	u32			type,
+	struct notify_source	**ret)
+{
+	struct notify_source	*source, *found = NULL;
+	struct list_head	*bucket, *node;
+	acpi_status		status;
+	char			pathname[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	strbuf = {ACPI_PATHNAME_MAX, pathname};
+	char			*name;
+
+	bucket = notify_source_bucket(handle, type);
+
+	list_for_each(node, bucket) {
+		source = list_entry(node, struct notify_source, node);
+
+		if (source->device == handle && source->type == type) {
+			if (source->refs) {
+				*ret = source;
+				return 0;
+			}
+			found = source;
+			break;
+		}
+	}
+
+	memset(pathname, 0, sizeof(pathname));
+
+	if (ACPI_FAILURE(acpi_get_name(handle, ACPI_FULL_PATHNAME, &strbuf)))
+		sprintf(pathname, "????");
+
+	name = strdup(pathname);
+
+	if (!name)
+		return -ENOMEM;
+
+	source = found;
+
+	if (!source) {
+		source = kmalloc(sizeof(*source), GFP_KERNEL);
+
+		if (!source) {
+			kfree(name);
+			return -ENOMEM;
+		}
+
+		memset(source, 0, sizeof(*source));
+		INIT_LIST_HEAD(&source->subs);
+		source->device = handle;
+		source->type = type;
+	}
+
+	status = acpi_install_notify_handler(handle, type, dev_acpi_notify,
+	                                     source);
+
+	if (ACPI_FAILURE(status)) {
+		kfree(name);
+		if (!found)
+			kfree(source);
+		if (status == AE_ALREADY_EXISTS)
+			return -EEXIST;
+		return -EIO;
+	}
+
+	kfree(source->pathname);
+	source->pathname = name;
+
+	if (!found)
+		list_add_tail(&source->node, bucket);
+	*ret = source;
+	return 0;
+}
+
+/* Module unload, every file is closed so no handlers are left */
+static void
+notify_source_free_all(void)
+{
+	struct notify_source	*source;
+	struct list_head	*node, *tmp;
+	int			i;
+
+	for (i = 0 ; i < NOTIFY_SOURCE_BUCKETS ; i++) {
+		list_for_each_safe(node, tmp, &notify_sources[i]) {
+			source = list_entry(node, struct notify_source, node);
+			list_del(&source->node);
+			kfree(source->pathname);
+			kfree(source);
+		}
+	}
+}
+
+static void
+dev_acpi_notify_free_rcu(struct rcu_head *rcu)
+{
+	kfree(container_of(rcu, struct notify_list, rcu));
+}
+
+/*
+ * Unlink a subscription from its source, removing the ACPI CA handler
+ * with the last one.  The source itself stays, see above.  The caller
+ * frees the entry after a grace period.
+ */
+static void
+notify_source_put(struct notify_list *entry)
+{
+	struct notify_source	*source = entry->source;
+
+	down(&notify_sem);
+
+	list_del_rcu(&entry->sub);
+
+	if (!--source->refs)
+		acpi_remove_notify_handler(source->device, source->type,
+		                           dev_acpi_notify);
+
+	up(&notify_sem);
+}
+
+/* Subscribe this file to notifies of type on handle */
+static int
+dev_acpi_notify_install(
+	struct file	*f,
+	acpi_handle	handle,
+	u32		type)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct notify_list	*entry;
+	struct notify_source	*source;
+	int			ret;
+
+	if (!priv->events) {
+		ret = dev_acpi_event_ring(priv, event_depth);
+		if (ret)
+			return ret;
+	}
+
+	down(&priv->subs_sem);
+
+	if (dev_acpi_notify_find(priv, handle, type)) {
+		up(&priv->subs_sem);
+		return -EEXIST;
+	}
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+
+	if (!entry) {
+		up(&priv->subs_sem);
+		return -ENOMEM;
+	}
+
+	memset(entry, 0, sizeof(*entry));
+
+	down(&notify_sem);
+
+	ret = notify_source_get(handle, type, &source);
+
+	if (ret) {
+		up(&notify_sem);
+		up(&priv->subs_sem);
+		kfree(entry);
+		return ret;
+	}
+
+	entry->source = source;
+	entry->priv = priv;
+	entry->device = handle;
+	entry->type = type;
+
+	/* 0 is never used, so a zeroed record doesn't match anything */
+	if (!++priv->notify_ids)
+		++priv->notify_ids;
+	entry->id = priv->notify_ids;
+	memset(entry->mask, 0xff, sizeof(entry->mask));
+
+	source->refs++;
+	list_add_tail_rcu(&entry->sub, &source->subs);
+
+	up(&notify_sem);
+
+	list_add_tail(&entry->node, &priv->notify);
+
+	up(&priv->subs_sem);
+	return 0;
+}
+
+/* Drop this file's subscription, other subscribers keep theirs */
+static int
+dev_acpi_notify_remove(
+	struct file	*f,
+	acpi_handle	handle,
+	u32		type)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct notify_list	*entry;
+	unsigned int		i;
+
+	down(&priv->subs_sem);
+
+	entry = dev_acpi_notify_find(priv, handle, type);
+
+	if (!entry) {
+		up(&priv->subs_sem);
+		return -ENOENT;
+	}
+
+	/* queued events lose the pathname, but keep the ID */
+	spin_lock(&priv->lock);
+	entry->dead = 1;
+	for (i = 0 ; i < priv->ev_count ; i++) {
+		struct event_rec *rec;
+
+		rec = &priv->events[(priv->ev_head + i) % priv->ev_depth];
+		if (rec->sub == entry)
+			rec->sub = NULL;
+	}
+	spin_unlock(&priv->lock);
+
+	list_del(&entry->node);
+
+	up(&priv->subs_sem);
+
+	notify_source_put(entry);
+	call_rcu(&entry->rcu, dev_acpi_notify_free_rcu);
+	return 0;
+}
+
+/*
+ * A class that was idle doesn't get credit for the time it wasn't
+ * asking, its pass starts from the current one.  eval_sched_lock held.
+ */
+static u64
+eval_class_pass(struct eval_class *ec)
+{
+	return ec->pass < eval_vtime ? eval_vtime : ec->pass;
+}
+
+/* Charge a dispatch to cls, called with eval_sched_lock held */
+static void
+eval_sched_charge(u32 cls)
+{
+	struct eval_class	*ec = &eval_classes[cls];
+
+	eval_vtime = eval_class_pass(ec);
+	ec->pass = eval_vtime + EVAL_STRIDE / eval_class_weight[cls];
+}
+
+/*
+ * Wait for a slot in class cls.  *start is set to the time the
+ * evaluation was admitted, for eval_sched_exit().  A signal while
+ * waiting gives up the place in the queue.
+ */
+static int
+eval_sched_enter(
+	u32	cls,
+	u64	*start)
+{
+	struct eval_class	*ec = &eval_classes[cls];
+	struct eval_waiter	waiter;
+	u64			queued, now;
+
+	queued = dev_acpi_now();
+
+	spin_lock(&eval_sched_lock);
+
+	ec->stats.evaluations++;
+
+	/* a free slot means nobody's waiting, they get slots handed over */
+	if (eval_running < eval_slots) {
+		eval_running++;
+		eval_sched_charge(cls);
+		spin_unlock(&eval_sched_lock);
+		*start = queued;
+		return 0;
+	}
+
+	init_waitqueue_head(&waiter.wait);
+	waiter.go = 0;
+	list_add_tail(&waiter.node, &ec->queue);
+	ec->stats.queued++;
+
+	spin_unlock(&eval_sched_lock);
+
+	wait_event_interruptible(waiter.wait, waiter.go);
+
+	/* the waker is done with waiter once it drops the lock */
+	spin_lock(&eval_sched_lock);
+
+	/* if the slot was handed over as the signal came, take it */
+	if (!waiter.go) {
+		list_del(&waiter.node);
+		ec->stats.evaluations--;
+		ec->stats.queued--;
+		spin_unlock(&eval_sched_lock);
+		return -ERESTARTSYS;
+	}
+
+	now = dev_acpi_now();
+	ec->stats.wait_ns += now - queued;
+	if (now - queued > ec->stats.wait_max_ns)
+		ec->stats.wait_max_ns = now - queued;
+	spin_unlock(&eval_sched_lock);
+
+	*start = now;
+	return 0;
+}
+
+/* Evaluation done, account it and hand the slot to the next class due */
+static void
+eval_sched_exit(
+	u32	cls,
+	u64	start)
+{
+	struct eval_class	*ec = &eval_classes[cls], *next = NULL;
+	struct eval_waiter	*waiter;
+	u64			exec;
+	int			i, next_cls = 0;
+
+	exec = dev_acpi_now() - start;
+
+	spin_lock(&eval_sched_lock);
+
+	ec->stats.exec_ns += exec;
+	if (exec > ec->stats.exec_max_ns)
+		ec->stats.exec_max_ns = exec;
+
+	for (i = 0 ; i < DEV_ACPI_CLASSES ; i++) {
+		struct eval_class *c = &eval_classes[i];
+
+		if (list_empty(&c->queue))
+			continue;
+
+		if (!next || eval_class_pass(c) < eval_class_pass(next)) {
+			next = c;
+			next_cls = i;
+		}
+	}
+
+	if (next) {
+		/* the slot passes straight to the waiter */
+		waiter = list_entry(next->queue.next, struct eval_waiter, node);
+		list_del(&waiter->node);
+		eval_sched_charge(next_cls);
+		waiter->go = 1;
+		wake_up(&waiter->wait);
+	} else
+		eval_running--;
+
+	spin_unlock(&eval_sched_lock);
+}
+
+/*
+ * acpi_evaluate_object() through the scheduler, in the caller's class.
+ * Returns -ERESTARTSYS if a signal came while waiting for a slot,
+ * otherwise 0 with the ACPI CA result in *status.
+ */
+static int
+dev_acpi_sched_evaluate(
+	u32			cls,
+	acpi_handle		handle,
+	struct acpi_object_list	*args,
+	struct acpi_buffer	*buffer,
+	acpi_status		*status)
+{
+	u64	start;
+
+	if (!eval_slots) {
+		*status = acpi_evaluate_object(handle, NULL, args, buffer);
+		return 0;
+	}
+
+	if (eval_sched_enter(cls, &start))
+		return -ERESTARTSYS;
+
+	*status = acpi_evaluate_object(handle, NULL, args, buffer);
+	eval_sched_exit(cls, start);
+
+	return 0;
+}
+
+/*
+ * Append a record to the sample ring, dropping it if the reader is a
+ * whole ring behind.  Only the worker writes records.
+ */
+static int
+sampler_put(
+	priv_data_t		*priv,
+	dev_acpi_sample_t	*rec)
+{
+	dev_acpi_sampler_ring_t	*ring = priv->ring;
+	u32			head = priv->ring_head;
+
+	if (head - ring->tail >= SAMPLER_SLOTS) {
+		ring->overflows++;
+		return 0;
+	}
+
+	((dev_acpi_sample_t *)(ring + 1))[head & (SAMPLER_SLOTS - 1)] = *rec;
+
+	/* record before head, the reader may be looking at the mapping */
+	smp_wmb();
+	ring->head = priv->ring_head = head + 1;
+	return 1;
+}
+
+/*
+ * Value change sampler, queue an event on the notify path if the
+ * integer result differs from last time (or is the first one).  Failed
+ * or non-integer evaluations are skipped.  Returns 1 if queued.
+ */
+static int
+dev_acpi_sample_change(
+	priv_data_t		*priv,
+	struct sampler_entry	*entry)
+{
+	struct acpi_buffer	buffer;
+	union acpi_object	obj;
+	struct event_rec	*rec;
+	acpi_handle		handle;
+	acpi_status		status;
+	u64			timestamp;
+
+	timestamp = dev_acpi_now();
+	handle = dev_acpi_get_handle(entry->pathname);
+
+	if (!handle)
+		return 0;
+
+	buffer.length = sizeof(obj);
+	buffer.pointer = &obj;
+
+	if (dev_acpi_sched_evaluate(priv->eval_class, handle, NULL, &buffer,
+	                            &status) ||
+	    ACPI_FAILURE(status) || obj.type != ACPI_TYPE_INTEGER)
+		return 0;
+
+	if (entry->have_value && entry->value == obj.integer.value)
+		return 0;
+
+	spin_lock(&priv->lock);
+
+	if (priv->ev_count == priv->ev_depth) {
+		/* try again next time */
+		priv->ev_overflows++;
+		spin_unlock(&priv->lock);
+		return 0;
+	}
+
+	rec = &priv->events[(priv->ev_head + priv->ev_count) % priv->ev_depth];
+	memset(rec, 0, sizeof(*rec));
+	rec->sampler = entry;
+	rec->id = entry->id;
+	rec->event = DEV_ACPI_EVENT_VALUE_CHANGE;
+	rec->timestamp = timestamp;
+	rec->count = 1;
+	rec->old_value = entry->have_value ? entry->value : obj.integer.value;
+	rec->new_value = obj.integer.value;
+	priv->ev_count++;
+	priv->ev_seq++;
+
+	spin_unlock(&priv->lock);
+
+	entry->value = obj.integer.value;
+	entry->have_value = 1;
+	return 1;
+}
+
+/*
+ * Evaluate one sampler, a record per integer result (per integer
+ * element of a package).  Returns the number of records written.
+ */
+static int
+dev_acpi_sample(
+	priv_data_t		*priv,
+	struct sampler_entry	*entry)
+{
+	struct acpi_buffer	buffer = {ACPI_ALLOCATE_BUFFER, NULL};
+	union acpi_object	*obj;
+	dev_acpi_sample_t	rec;
+	acpi_handle		handle;
+	acpi_status		status;
+	u32			i;
+	int			count = 0;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.sample = entry->id;
+	rec.timestamp = dev_acpi_now();
+
+	handle = dev_acpi_get_handle(entry->pathname);
+
+	if (!handle) {
+		rec.status = ENOENT;
+		return sampler_put(priv, &rec);
+	}
+
+	if (dev_acpi_sched_evaluate(priv->eval_class, handle, NULL, &buffer,
+	                            &status) ||
+	    ACPI_FAILURE(status) || !buffer.pointer) {
+		rec.status = EIO;
+		return sampler_put(priv, &rec);
+	}
+
+	obj = buffer.pointer;
+
+	if (obj->type == ACPI_TYPE_INTEGER) {
+		rec.value = obj->integer.value;
+		count = sampler_put(priv, &rec);
+
+	} else if (obj->type == ACPI_TYPE_PACKAGE) {
+		for (i = 0 ; i < obj->package.count ; i++) {
+			union acpi_object *el = &obj->package.elements[i];
+
+			if (el->type != ACPI_TYPE_INTEGER)
+				continue;
+
+			rec.index = i;
+			rec.value = el->integer.value;
+			count += sampler_put(priv, &rec);
+		}
+	}
+
+	if (!count && obj->type != ACPI_TYPE_INTEGER) {
+		rec.status = EINVAL;
+		rec.index = 0;
+		count = sampler_put(priv, &rec);
+	}
+
+	kfree(buffer.pointer);
+	return count;
+}
+
+#ifdef DEV_ACPI_KTHREAD
+/* The per open worker, samples whatever is due then sleeps */
+static int
+dev_acpi_sampler_thread(void *data)
+{
+	priv_data_t		*priv = (priv_data_t *)data;
+	struct sampler_entry	*entry;
+	struct list_head	*node;
+	unsigned long		now, next;
+	int			wrote;
+
+	while (!kthread_should_stop()) {
+		wrote = 0;
+
+		down(&priv->sampler_sem);
+
+		now = jiffies;
+		next = now + msecs_to_jiffies(SAMPLER_INTERVAL_MAX);
+
+		list_for_each(node, &priv->samplers) {
+			entry = list_entry(node, struct sampler_entry, node);
+
+			if (time_after_eq(now, entry->due)) {
+				if (entry->flags & DEV_ACPI_SAMPLER_CHANGES)
+					wrote += dev_acpi_sample_change(priv,
+					                                entry);
+				else
+					wrote += dev_acpi_sample(priv, entry);
+				entry->due += entry->interval;
+
+				/* fell behind, don't try to catch up */
+				if (time_before_eq(entry->due, now))
+					entry->due = now + entry->interval;
+			}
+
+			if (time_before(entry->due, next))
+				next = entry->due;
+		}
+
+		priv->sampler_kick = 0;
+		up(&priv->sampler_sem);
+
+		/* one wakeup per pass, however many objects were sampled */
+		if (wrote)
+			wake_up_interruptible(&priv->wait);
+
+		now = jiffies;
+		if (time_after(next, now))
+			wait_event_interruptible_timeout(priv->sampler_wait,
+			                                 kthread_should_stop() ||
+			                                 priv->sampler_kick,
+			                                 next - now);
+	}
+	return 0;
+}
+#endif
+
+/*
+ * Ring and worker are created with the first sampler and stay until
+ * the file is closed.  Called with sampler_sem held.
+ */
+static int
+dev_acpi_sampler_start(priv_data_t *priv)
+{
+	struct task_struct	*task;
+
+	if (!priv->ring) {
+		priv->ring = vmalloc(SAMPLER_RING_SIZE);
+
+		if (!priv->ring)
+			return -ENOMEM;
+
+		memset(priv->ring, 0, SAMPLER_RING_SIZE);
+		priv->ring->slots = SAMPLER_SLOTS;
+		priv->ring_head = 0;
+	}
+
+	if (priv->sampler)
+		return 0;
+
+#ifdef DEV_ACPI_KTHREAD
+	task = kthread_run(dev_acpi_sampler_thread, priv, "kacpi_sampler");
+#else
+	task = ERR_PTR(-ENOSYS);
+#endif
+
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+
+	priv->sampler = task;
+	return 0;
+}
+
+/* Stop the worker and drop every sampler, on release */
+static void
+dev_acpi_sampler_stop(priv_data_t *priv)
+{
+	struct sampler_entry	*entry;
+
+#ifdef DEV_ACPI_KTHREAD
+	if (priv->sampler) {
+		kthread_stop(priv->sampler);
+		priv->sampler = NULL;
+	}
+#endif
+
+	while (!list_empty(&priv->samplers)) {
+		entry = list_entry(priv->samplers.next, struct sampler_entry,
+		                   node);
+		list_del(&entry->node);
+		kfree(entry->pathname);
+		kfree(entry);
+	}
+	priv->change_samplers = 0;
+}
+
+static int
+dev_acpi_sampler_add(
+	struct file		*f,
+	dev_acpi_sampler_t	*data)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct sampler_entry	*entry;
+	struct list_head	*node;
+	acpi_handle		handle;
+	char			pathname[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	strbuf = {ACPI_PATHNAME_MAX, pathname};
+	int			count, ret;
+
+	if (data->interval_ms < SAMPLER_INTERVAL_MIN ||
+	    data->interval_ms > SAMPLER_INTERVAL_MAX ||
+	    (data->flags & ~DEV_ACPI_SAMPLER_CHANGES))
+		return -EINVAL;
+
+	/* changes are delivered as events */
+	if ((data->flags & DEV_ACPI_SAMPLER_CHANGES) && !priv->events) {
+		ret = dev_acpi_event_ring(priv, event_depth);
+		if (ret)
+			return ret;
+	}
+
+	if (data->id)
+		handle = dev_acpi_id_handle(priv, data->id, data->pathname,
+		                            sizeof(data->pathname));
+	else
+		handle = dev_acpi_get_handle(data->pathname);
+
+	if (!handle)
+		return -ENOENT;
+
+	memset(pathname, 0, sizeof(pathname));
+
+	if (ACPI_FAILURE(acpi_get_name(handle, ACPI_FULL_PATHNAME, &strbuf)))
+		return -ENOENT;
+
+	entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+
+	if (!entry)
+		return -ENOMEM;
+
+	memset(entry, 0, sizeof(*entry));
+	entry->pathname = strdup(pathname);
+
+	if (!entry->pathname) {
+		kfree(entry);
+		return -ENOMEM;
+	}
+
+	entry->flags = data->flags;
+	entry->interval = msecs_to_jiffies(data->interval_ms);
+	if (!entry->interval)
+		entry->interval = 1;
+
+	down(&priv->sampler_sem);
+
+	count = 0;
+	list_for_each(node, &priv->samplers)
+		count++;
+
+	ret = (count >= SAMPLERS_MAX) ? -ENOSPC : dev_acpi_sampler_start(priv);
+
+	if (ret) {
+		up(&priv->sampler_sem);
+		kfree(entry->pathname);
+		kfree(entry);
+		return ret;
+	}
+
+	if (!++priv->sampler_ids)
+		++priv->sampler_ids;
+	entry->id = priv->sampler_ids;
+	entry->due = jiffies;
+	list_add_tail(&entry->node, &priv->samplers);
+	priv->sampler_kick = 1;
+
+	if (entry->flags & DEV_ACPI_SAMPLER_CHANGES)
+		priv->change_samplers++;
+
+	up(&priv->sampler_sem);
+
+	wake_up_interruptible(&priv->sampler_wait);
+
+	data->sample = entry->id;
+	return 0;
+}
+
+static int
+dev_acpi_sampler_remove(
+	struct file	*f,
+	u32		id)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct sampler_entry	*entry;
+	struct list_head	*node;
+
+	down(&priv->sampler_sem);
+
+	list_for_each(node, &priv->samplers) {
+		entry = list_entry(node, struct sampler_entry, node);
+
+		if (entry->id == id)
+			break;
+	}
+
+	if (node == &priv->samplers) {
+		up(&priv->sampler_sem);
+		return -ENOENT;
+	}
+
+	list_del(&entry->node);
+
+	if (entry->flags & DEV_ACPI_SAMPLER_CHANGES) {
+		unsigned int i;
+
+		/* queued events lose the pathname, but keep the ID */
+		spin_lock(&priv->lock);
+		for (i = 0 ; i < priv->ev_count ; i++) {
+			struct event_rec *rec;
+
+			rec = &priv->events[(priv->ev_head + i) %
+			                    priv->ev_depth];
+			if (rec->sampler == entry)
+				rec->sampler = NULL;
+		}
+		spin_unlock(&priv->lock);
+
+		priv->change_samplers--;
+	}
+
+	up(&priv->sampler_sem);
+
+	/* readers blocked on the last event source need to bail out */
+	wake_up_interruptible(&priv->wait);
+
+	kfree(entry->pathname);
+	kfree(entry);
+	return 0;
+}
+
+/* Move unread records to the read buffer */
+static int
+dev_acpi_sampler_read(struct file *f)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*rbuf = RBUF(f);
+	dev_acpi_sampler_ring_t	*ring = priv->ring;
+	dev_acpi_sample_t	*out;
+	u32			head, tail, count, i;
+
+	if (!ring)
+		return -ENXIO;
+
+	head = priv->ring_head;
+	smp_rmb();
+	tail = ring->tail;
+	count = head - tail;
+
+	/* the mapping is writable, don't trust tail */
+	if (count > SAMPLER_SLOTS) {
+		tail = head - SAMPLER_SLOTS;
+		count = SAMPLER_SLOTS;
+	}
+
+	if (!count)
+		return 0;
+
+	out = kmalloc(count * sizeof(*out), GFP_KERNEL);
+
+	if (!out)
+		return -ENOMEM;
+
+	for (i = 0 ; i < count ; i++)
+		out[i] = ((dev_acpi_sample_t *)(ring + 1))
+		         [(tail + i) & (SAMPLER_SLOTS - 1)];
+
+	/* done with the slots before handing them back */
+	smp_mb();
+	ring->tail = tail + count;
+
+	rbuf->pointer = out;
+	rbuf->length = count * sizeof(*out);
+	return 0;
+}
+
+static int dev_acpi_evaluate(acpi_handle, struct acpi_object_list *,
+                             struct acpi_buffer *, u32);
+
+#ifdef DEV_ACPI_KTHREAD
+/*
+ * Worker for DEV_ACPI_ASYNC_SUBMIT, evaluates queued requests in order
+ * and moves them to async_done.  Readers are woken per completion.
+ */
+static int
+dev_acpi_async_thread(void *data)
+{
+	priv_data_t		*priv = (priv_data_t *)data;
+	struct async_req	*req;
+	union acpi_object	args[DEV_ACPI_FAST_ARGS];
+	struct acpi_object_list	arg_list = {0, args};
+	u32			i;
+
+	while (!kthread_should_stop()) {
+		spin_lock(&priv->lock);
+
+		if (list_empty(&priv->async_queue)) {
+			spin_unlock(&priv->lock);
+			wait_event_interruptible(priv->async_wait,
+			                         kthread_should_stop() ||
+			                         !list_empty(&priv->async_queue));
+			continue;
+		}
+
+		req = list_entry(priv->async_queue.next, struct async_req,
+		                 node);
+		list_del(&req->node);
+		spin_unlock(&priv->lock);
+
+		memset(args, 0, sizeof(args));
+
+		for (i = 0 ; i < req->arg_count ; i++) {
+			args[i].type = ACPI_TYPE_INTEGER;
+			args[i].integer.value = req->args[i];
+		}
+		arg_list.count = req->arg_count;
+
+		req->status = dev_acpi_evaluate(req->handle,
+		                                req->arg_count ? &arg_list :
+		                                                 NULL,
+		                                &req->result, priv->eval_class);
+		req->latency = dev_acpi_now() - req->submitted;
+
+		spin_lock(&priv->lock);
+		list_add_tail(&req->node, &priv->async_done);
+		spin_unlock(&priv->lock);
+
+		wake_up_interruptible(&priv->wait);
+	}
+	return 0;
+}
+#endif
+
+/* Stop the worker and drop every request, on release */
+static void
+dev_acpi_async_stop(priv_data_t *priv)
+{
+	struct async_req	*req;
+
+#ifdef DEV_ACPI_KTHREAD
+	if (priv->async) {
+		kthread_stop(priv->async);
+		priv->async = NULL;
+	}
+#endif
+
+	list_splice_init(&priv->async_queue, &priv->async_done);
+
+	while (!list_empty(&priv->async_done)) {
+		req = list_entry(priv->async_done.next, struct async_req,
+		                 node);
+		list_del(&req->node);
+		kfree(req->result.pointer);
+		kfree(req);
+	}
+	priv->async_count = 0;
+}
+
+/*
+ * Queue the evaluations in the write buffer.  Requests that can't be
+ * resolved complete straight away with their status.  Returns the number
+ * queued, fewer than count once ASYNC_MAX are outstanding.
+ */
+static int
+dev_acpi_async_submit(
+	struct file	*f,
+	u32		count)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*wbuf = WBUF(f);
+	dev_acpi_async_op_t	*ops;
+	struct async_req	*req;
+	struct task_struct	*task;
+	u32			i, done = 0;
+
+	if (!count || count > ASYNC_MAX || !wbuf->pointer ||
+	    wbuf->length < count * sizeof(*ops))
+		return -EINVAL;
+
+	ops = wbuf->pointer;
+
+	down(&priv->async_sem);
+	if (!priv->async) {
+#ifdef DEV_ACPI_KTHREAD
+		task = kthread_run(dev_acpi_async_thread, priv, "kacpi_async");
+#else
+		task = ERR_PTR(-ENOSYS);
+#endif
+
+		if (IS_ERR(task)) {
+			up(&priv->async_sem);
+			return PTR_ERR(task);
+		}
+		priv->async = task;
+	}
+	up(&priv->async_sem);
+
+	for (i = 0 ; i < count ; i++) {
+		req = kmalloc(sizeof(*req), GFP_KERNEL);
+		if (!req)
+			break;
+
+		memset(req, 0, sizeof(*req));
+		req->tag = ops[i].tag;
+		req->submitted = dev_acpi_now();
+
+		if (ops[i].arg_count > DEV_ACPI_FAST_ARGS) {
+			req->status = -EINVAL;
+		} else {
+			if (ops[i].id)
+				req->handle = dev_acpi_id_handle(priv,
+				                    ops[i].id, ops[i].pathname,
+				                    sizeof(ops[i].pathname));
+			else
+				req->handle = dev_acpi_get_handle(
+				                              ops[i].pathname);
+
+			if (!req->handle)
+				req->status = -ENOENT;
+		}
+
+		req->arg_count = ops[i].arg_count;
+		memcpy(req->args, ops[i].args, sizeof(req->args));
+
+		spin_lock(&priv->lock);
+
+		if (priv->async_count == ASYNC_MAX) {
+			spin_unlock(&priv->lock);
+			kfree(req);
+			break;
+		}
+
+		priv->async_count++;
+
+		if (req->status) {
+			list_add_tail(&req->node, &priv->async_done);
+			done++;
+		} else
+			list_add_tail(&req->node, &priv->async_queue);
+
+		spin_unlock(&priv->lock);
+	}
+
+	if (!i)
+		return priv->async_count == ASYNC_MAX ? -EAGAIN : -ENOMEM;
+
+	wake_up(&priv->async_wait);
+
+	if (done)
+		wake_up_interruptible(&priv->wait);
+
+	return i;
+}
+
+/*
+ * Move up to max (0 = all) completions to the read buffer, laid out like
+ * DEV_ACPI_BATCH results.  Returns the number reaped.
+ */
+static int
+dev_acpi_async_reap(
+	struct file	*f,
+	u32		max)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*rbuf = RBUF(f);
+	dev_acpi_completion_t	*comp;
+	struct async_req	*req, *tmp;
+	result_buf_t		rb = {NULL, 0, 0};
+	LIST_HEAD(reaped);
+	u32			count = 0, i, offset;
+
+	spin_lock(&priv->lock);
+
+	while (!list_empty(&priv->async_done) && (!max || count < max)) {
+		list_move_tail(priv->async_done.next, &reaped);
+		count++;
+	}
+	priv->async_count -= count;
+
+	spin_unlock(&priv->lock);
+
+	if (!count)
+		return 0;
+
+	if (!result_buf_reserve(&rb, count * sizeof(*comp)))
+		goto nomem;
+
+	memset(rb.pointer, 0, count * sizeof(*comp));
+	rb.length = count * sizeof(*comp);
+	i = 0;
+
+	list_for_each_entry(req, &reaped, node) {
+		offset = 0;
+
+		if (!req->status && req->result.length) {
+			/* objects contain 64bit integers, keep them aligned */
+			offset = (rb.length + 7) & ~7;
+
+			if (!result_buf_reserve(&rb, offset - rb.length +
+			                             req->result.length))
+				goto nomem;
+
+			memset(rb.pointer + rb.length, 0, offset - rb.length);
+			memcpy(rb.pointer + offset, req->result.pointer,
+			       req->result.length);
+			rb.length = offset + req->result.length;
+		}
+
+		comp = (dev_acpi_completion_t *)rb.pointer + i++;
+		comp->tag = req->tag;
+		comp->status = -req->status;
+		comp->offset = offset;
+		comp->length = offset ? req->result.length : 0;
+		comp->latency = req->latency;
+	}
+
+	list_for_each_entry_safe(req, tmp, &reaped, node) {
+		kfree(req->result.pointer);
+		kfree(req);
+	}
+
+	rbuf->pointer = rb.pointer;
+	rbuf->length = rb.length;
+	return count;
+
+nomem:
+	/* nothing is lost, they're reaped next time */
+	result_buf_free(&rb);
+
+	spin_lock(&priv->lock);
+	list_splice(&reaped, &priv->async_done);
+	priv->async_count += count;
+	spin_unlock(&priv->lock);
+	return -ENOMEM;
+}
+
+static unsigned int
+dev_acpi_poll(
+	struct file	*f,
+	poll_table	*wait)
+{
+	priv_data_t	*priv;
+	unsigned int	mask = 0;
+
+	priv = (priv_data_t *)f->private_data;
+
+	poll_wait(f, &priv->wait, wait);
+
+	if (priv->ev_count)
+		mask |= POLLIN | POLLRDNORM;
+
+	/* an unread ioctl result, read() hands it out ahead of events */
+	if (dev_acpi_ready_mine(f))
+		mask |= POLLMSG;
+
+	/* samples are read from the ring, not with read() */
+	if (priv->ring && priv->ring_head != priv->ring->tail)
+		mask |= POLLPRI;
+
+	/* completions waiting for DEV_ACPI_ASYNC_REAP */
+	if (!list_empty(&priv->async_done))
+		mask |= POLLRDBAND;
+
+	return mask;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,0)
+static struct page *
+dev_acpi_vma_nopage(
+	struct vm_area_struct	*vma,
+	unsigned long		address,
+	int			*type)
+{
+	priv_data_t	*priv = (priv_data_t *)vma->vm_file->private_data;
+	unsigned long	offset = address - vma->vm_start;
+	struct page	*page;
+
+	if (offset >= priv->area_size)
+		return NOPAGE_SIGBUS;
+
+	page = vmalloc_to_page((char *)priv->area + offset);
+	get_page(page);
+
+	if (type)
+		*type = VM_FAULT_MINOR;
+
+	return page;
+}
+
+static struct vm_operations_struct dev_acpi_vm_ops = {
+	.nopage		= dev_acpi_vma_nopage,
+};
+
+static struct page *
+dev_acpi_ring_nopage(
+	struct vm_area_struct	*vma,
+	unsigned long		address,
+	int			*type)
+{
+	priv_data_t	*priv = (priv_data_t *)vma->vm_file->private_data;
+	unsigned long	offset = address - vma->vm_start;
+	struct page	*page;
+
+	if (!priv->ring || offset >= SAMPLER_RING_SIZE)
+		return NOPAGE_SIGBUS;
+
+	page = vmalloc_to_page((char *)priv->ring + offset);
+	get_page(page);
+
+	if (type)
+		*type = VM_FAULT_MINOR;
+
+	return page;
+}
+
+static struct vm_operations_struct dev_acpi_ring_vm_ops = {
+	.nopage		= dev_acpi_ring_nopage,
+};
+
+/*
+ * Map the per open result area, read only.  The first mmap sizes it,
+ * later ones may map all or part of it.
+ */
+static int
+dev_acpi_mmap(
+	struct file		*f,
+	struct vm_area_struct	*vma)
+{
+	priv_data_t	*priv = (priv_data_t *)f->private_data;
+	unsigned long	size = vma->vm_end - vma->vm_start;
+	void		*area;
+
+	/* the sample ring, shared so the reader can advance tail */
+	if (vma->vm_pgoff == DEV_ACPI_SAMPLER_MMAP >> PAGE_SHIFT) {
+		if (!priv->ring)
+			return -ENXIO;
+
+		if (size > SAMPLER_RING_SIZE)
+			return -EINVAL;
+
+		if ((vma->vm_flags & VM_WRITE) && !(vma->vm_flags & VM_SHARED))
+			return -EINVAL;
+
+		vma->vm_flags |= VM_RESERVED;
+		vma->vm_ops = &dev_acpi_ring_vm_ops;
+		return 0;
+	}
+
+	if (vma->vm_pgoff || size > MMAP_AREA_MAX)
+		return -EINVAL;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+
+	if (!priv->area) {
+		area = vmalloc(size);
+
+		if (!area)
+			return -ENOMEM;
+
+		memset(area, 0, size);
+
+		spin_lock(&priv->lock);
+		if (!priv->area) {
+			priv->area = area;
+			priv->area_size = size;
+			area = NULL;
+		}
+		spin_unlock(&priv->lock);
+
+		vfree(area);
+	}
+
+	if (size > priv->area_size)
+		return -EINVAL;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_RESERVED;
+	vma->vm_ops = &dev_acpi_vm_ops;
+	return 0;
+}
+#endif
+
+static int
+dev_acpi_open(
+	struct inode	*i,
+	struct file	*f)
+{
+	priv_data_t	*priv;
+
+	if (!try_module_get(THIS_MODULE))
+		return -EBUSY;
+
+	f->private_data = kmalloc(sizeof(priv_data_t), GFP_KERNEL);
+	if (!f->private_data) {
+		module_put(THIS_MODULE);
+		return -ENOMEM;
+	}
+
+	memset(f->private_data, 0, sizeof(priv_data_t));
+
+	priv = (priv_data_t *)f->private_data;
+	spin_lock_init(&priv->lock);
+	init_waitqueue_head(&priv->wait);
+	INIT_LIST_HEAD(&priv->ctxs);
+	init_MUTEX(&priv->shared_sem);
+	priv->eval_class = DEV_ACPI_CLASS_NORMAL;
+	init_MUTEX(&priv->subs_sem);
+	init_MUTEX(&priv->ids_sem);
+	INIT_LIST_HEAD(&priv->notify);
+	INIT_LIST_HEAD(&priv->samplers);
+	init_MUTEX(&priv->sampler_sem);
+	init_waitqueue_head(&priv->sampler_wait);
+	INIT_LIST_HEAD(&priv->async_queue);
+	INIT_LIST_HEAD(&priv->async_done);
+	init_MUTEX(&priv->async_sem);
+	init_waitqueue_head(&priv->async_wait);
+	return 0;
+}
+
+static int
+dev_acpi_release(
+	struct inode	*i,
+	struct file	*f)
+{
+	struct list_head	*list, *node;
+	struct notify_list	*notify;
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+
+	list = &priv->notify;
+
+	if (!list_empty(list)) {
+		list_for_each(node, list) {
+			notify = list_entry(node, struct notify_list, node);
+			notify_source_put(notify);
+		}
+
+		/* the handler may still be queueing on this file */
+		synchronize_rcu();
+
+		while (!list_empty(list)) {
+			notify = list_entry(list->next, struct notify_list,
+			                    node);
+			list_del(&notify->node);
+			kfree(notify);
+		}
+	}
+
+	kfree(priv->shared.read.pointer);
+	kfree(priv->shared.write.pointer);
+
+	while (!list_empty(&priv->ctxs)) {
+		struct file_ctx *ctx;
+
+		ctx = list_entry(priv->ctxs.next, struct file_ctx, node);
+		list_del(&ctx->node);
+		file_ctx_free(ctx);
+	}
+
+	if (priv->ids) {
+		int i;
+
+		for (i = 0 ; i < HANDLE_IDS_MAX ; i++)
+			kfree(priv->ids[i].pathname);
+		kfree(priv->ids);
+	}
+
+	dev_acpi_sampler_stop(priv);
+	dev_acpi_async_stop(priv);
+	vfree(priv->ring);
+	vfree(priv->area);
+	kfree(priv->events);
+	kfree(f->private_data);
+	module_put(THIS_MODULE);
+	return 0;
+}
+
+/*
+ * Evaluate with arguments and result inline in dev_acpi_eval_fast_t.
+ * The arguments live on the stack and the read and write buffers are
+ * left alone.  The result comes back in an allocated buffer, so its type
+ * is known even when it doesn't fit inline.  Goes through eval_cache
+ * like the other evaluations.
+ */
+static int
+dev_acpi_eval_fast(
+	priv_data_t		*priv,
+	dev_acpi_eval_fast_t	*fast)
+{
+	acpi_handle		handle;
+	union acpi_object	args[DEV_ACPI_FAST_ARGS], *obj;
+	struct acpi_object_list	arg_list = {0, args};
+	struct acpi_buffer	buffer = {0, NULL};
+	u32			i;
+	int			ret;
+
+	if (fast->arg_count > DEV_ACPI_FAST_ARGS)
+		return -EINVAL;
+
+	if (fast->id)
+		handle = dev_acpi_id_handle(priv, fast->id, fast->pathname,
+		                            sizeof(fast->pathname));
+	else
+		handle = dev_acpi_get_handle(fast->pathname);
+
+	if (!handle)
+		return -ENOENT;
+
+	memset(args, 0, sizeof(args));
+
+	for (i = 0 ; i < fast->arg_count ; i++) {
+		args[i].type = ACPI_TYPE_INTEGER;
+		args[i].integer.value = fast->args[i];
+	}
+	arg_list.count = fast->arg_count;
+
+	fast->type = 0;
+	fast->length = 0;
+	fast->value = 0;
+	memset(fast->data, 0, sizeof(fast->data));
+
+	ret = dev_acpi_evaluate(handle, fast->arg_count ? &arg_list : NULL,
+	                        &buffer, priv->eval_class);
+	if (ret)
+		return ret;
+
+	if (!buffer.length || !buffer.pointer)
+		return 0;
+
+	/* the result is offset encoded for userspace, turn it back */
+	obj = buffer.pointer;
+	if (!fixup_element(obj, &buffer, TO_POINTER)) {
+		kfree(buffer.pointer);
+		return -EFAULT;
+	}
+
+	fast->type = obj->type;
+
+	switch (obj->type) {
+	case ACPI_TYPE_INTEGER:
+		fast->value = obj->integer.value;
+		break;
+
+	case ACPI_TYPE_STRING:
+		if (obj->string.length >= sizeof(fast->data)) {
+			ret = -E2BIG;
+			break;
+		}
+
+		fast->length = obj->string.length;
+		memcpy(fast->data, obj->string.pointer, obj->string.length);
+		break;
+
+	case ACPI_TYPE_BUFFER:
+		if (obj->buffer.length > sizeof(fast->data)) {
+			ret = -E2BIG;
+			break;
+		}
+
+		fast->length = obj->buffer.length;
+		memcpy(fast->data, obj->buffer.pointer, obj->buffer.length);
+		break;
+
+	default:
+		ret = -E2BIG;
+		break;
+	}
+
+	kfree(buffer.pointer);
+	return ret;
+}
+
+/*
+ * Cache lifetime for handle's results, 0 if its name isn't in eval_cache
+ */
+static unsigned long
+eval_cache_lookup_ttl(acpi_handle handle)
+{
+	char			name[ACPI_PATHNAME_MAX];
+	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, name};
+	unsigned int		i;
+	u32			seg;
+
+	if (!eval_cache_name_count)
+		return 0;
+
+	memset(name, 0, sizeof(name));
+
+	if (ACPI_FAILURE(acpi_get_name(handle, ACPI_SINGLE_NAME, &buffer)))
+		return 0;
+
+	memcpy(&seg, name, sizeof(seg));
+
+	for (i = 0 ; i < eval_cache_name_count ; i++)
+		if (eval_cache_names[i].name == seg)
+			return eval_cache_names[i].ttl;
+	return 0;
+}
+
+/*
+ * Serialize the arguments into key.  Integers, strings and buffers only,
+ * returns the key length or -1 if the arguments can't be cached.
+ */
+static int
+eval_cache_key(struct acpi_object_list *args, u8 *key)
+{
+	union acpi_object	*arg;
+	u32			i, len = 0, size;
+	void			*data;
+
+	if (!args)
+		return 0;
+
+	for (i = 0 ; i < args->count ; i++) {
+		arg = &args->pointer[i];
+
+		switch (arg->type) {
+		case ACPI_TYPE_INTEGER:
+			size = sizeof(arg->integer.value);
+			data = &arg->integer.value;
+			break;
+		case ACPI_TYPE_STRING:
+			size = arg->string.length;
+			data = arg->string.pointer;
+			break;
+		case ACPI_TYPE_BUFFER:
+			size = arg->buffer.length;
+			data = arg->buffer.pointer;
+			break;
+		default:
+			return -1;
+		}
+
+		if (size > EVAL_KEY_MAX - len - 2 * sizeof(u32))
+			return -1;
+
+		memcpy(key + len, &arg->type, sizeof(u32));
+		memcpy(key + len + sizeof(u32), &size, sizeof(u32));
+		memcpy(key + len + 2 * sizeof(u32), data, size);
+		len += 2 * sizeof(u32) + size;
+	}
+	return len;
+}
+
+/* Called with eval_cache_lock held, entries are freed by the caller */
+static void
+eval_cache_unlink(struct eval_cache_entry *entry, struct list_head *dead)
+{
+	list_del(&entry->lru);
+	list_move(&entry->node, dead);
+	eval_cache_count--;
+}
+
+static void
+eval_cache_free(struct list_head *dead)
+{
+	struct eval_cache_entry	*entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, dead, node) {
+		kfree(entry->result);
+		kfree(entry);
+	}
+}
+
+/*
+ * Copy a cached result out the way dev_acpi_evaluate() would return it,
+ * into buffer->pointer if it's set, otherwise a new allocation.  The
+ * caller holds a ref, the entry is dropped here.
+ */
+static int
+eval_cache_copy(
+	struct eval_cache_entry	*entry,
+	struct acpi_buffer	*buffer)
+{
+	int	ret = entry->status;
+
+	if (ret || !entry->length) {
+		buffer->length = 0;
+	} else if (buffer->pointer) {
+		if (buffer->length < entry->length)
+			ret = -E2BIG;
+		else {
+			memcpy(buffer->pointer, entry->result, entry->length);
+			buffer->length = entry->length;
+		}
+	} else {
+		buffer->pointer = kmalloc(entry->length, GFP_KERNEL);
+		if (!buffer->pointer)
+			ret = -ENOMEM;
+		else {
+			memcpy(buffer->pointer, entry->result, entry->length);
+			buffer->length = entry->length;
+		}
+	}
+
+	spin_lock(&eval_cache_lock);
+	entry->refs--;
+	spin_unlock(&eval_cache_lock);
+
+	return ret;
+}
+
+static int dev_acpi_evaluate_object(acpi_handle, struct acpi_object_list *,
+                                    struct acpi_buffer *, u32);
+
+/*
+ * dev_acpi_evaluate() through the cache.  A fresh entry is a hit, a
+ * pending one is waited for, otherwise this caller evaluates on behalf
+ * of everyone asking meanwhile.  Only successful results are kept.  If
+ * the evaluating caller is interrupted before it gets a slot the entry
+ * is abandoned and the waiters start over, one of them evaluates.
+ */
+static int
+eval_cache_evaluate(
+	acpi_handle		handle,
+	struct acpi_object_list	*args,
+	struct acpi_buffer	*buffer,
+	u32			cls,
+	unsigned long		ttl)
+{
+	struct eval_cache_entry	*entry, *tmp, *new = NULL;
+	struct acpi_buffer	result = {0, NULL};
+	struct list_head	*bucket;
+	LIST_HEAD(dead);
+	u8			key[EVAL_KEY_MAX];
+	int			key_len, ret;
+	u32			hash, gen;
+
+	key_len = eval_cache_key(args, key);
+	if (key_len < 0)
+		return dev_acpi_evaluate_object(handle, args, buffer, cls);
+
+	hash = jhash(key, key_len, (u32)(unsigned long)handle);
+	bucket = &eval_cache_buckets[hash & (EVAL_CACHE_BUCKETS - 1)];
+	gen = atomic_read(&ns_generation);
+
+again:
+	spin_lock(&eval_cache_lock);
+
+	list_for_each_entry_safe(entry, tmp, bucket, node) {
+		if (entry->handle != handle || entry->hash != hash ||
+		    entry->key_len != key_len ||
+		    memcmp(entry->key, key, key_len))
+			continue;
+
+		if (entry->pending && entry->generation == gen) {
+			entry->refs++;
+			eval_cache_coalesced++;
+			spin_unlock(&eval_cache_lock);
+			kfree(new);
+			eval_cache_free(&dead);
+
+			if (wait_event_interruptible(eval_cache_wait,
+			                             !entry->pending)) {
+				spin_lock(&eval_cache_lock);
+				entry->refs--;
+				spin_unlock(&eval_cache_lock);
+				return -ERESTARTSYS;
+			}
+
+			if (entry->status == -ERESTARTSYS) {
+				spin_lock(&eval_cache_lock);
+				entry->refs--;
+				spin_unlock(&eval_cache_lock);
+				new = NULL;
+				INIT_LIST_HEAD(&dead);
+				goto again;
+			}
+
+			return eval_cache_copy(entry, buffer);
+		}
+
+		if (!entry->pending && dev_acpi_ns_current(entry->generation) &&
+		    time_before(jiffies, entry->expires)) {
+			entry->refs++;
+			eval_cache_hits++;
+			list_move_tail(&entry->lru, &eval_cache_lru);
+			spin_unlock(&eval_cache_lock);
+			kfree(new);
+			eval_cache_free(&dead);
+
+			return eval_cache_copy(entry, buffer);
+		}
+
+		/* stale */
+		if (!entry->pending && !entry->refs)
+			eval_cache_unlink(entry, &dead);
+	}
+
+	/* allocate outside the lock, someone may have beaten us to it */
+	if (!new) {
+		spin_unlock(&eval_cache_lock);
+		eval_cache_free(&dead);
+		INIT_LIST_HEAD(&dead);
+
+		new = kmalloc(sizeof(*new), GFP_KERNEL);
+		if (!new)
+			return dev_acpi_evaluate_object(handle, args, buffer, cls);
+		goto again;
+	}
+
+	eval_cache_misses++;
+
+	/* make room, oldest first */
+	if (eval_cache_count >= EVAL_CACHE_MAX) {
+		list_for_each_entry_safe(entry, tmp, &eval_cache_lru, lru) {
+			if (!entry->pending && !entry->refs) {
+				eval_cache_unlink(entry, &dead);
+				break;
+			}
+		}
+	}
+
+	if (eval_cache_count >= EVAL_CACHE_MAX) {
+		spin_unlock(&eval_cache_lock);
+		eval_cache_free(&dead);
+		kfree(new);
+		return dev_acpi_evaluate_object(handle, args, buffer, cls);
+	}
+
+	memset(new, 0, sizeof(*new));
+	new->handle = handle;
+	new->hash = hash;
+	new->generation = gen;
+	new->pending = 1;
+	new->key_len = key_len;
+	memcpy(new->key, key, key_len);
+	list_add(&new->node, bucket);
+	list_add_tail(&new->lru, &eval_cache_lru);
+	eval_cache_count++;
+
+	spin_unlock(&eval_cache_lock);
+	eval_cache_free(&dead);
+
+	ret = dev_acpi_evaluate_object(handle, args, &result, cls);
+
+	spin_lock(&eval_cache_lock);
+	new->status = ret;
+	new->result = result.pointer;
+	new->length = result.length;
+	new->expires = ret ? jiffies : jiffies + ttl;
+	new->pending = 0;
+	if (ret != -ERESTARTSYS)
+		new->refs++;
+	spin_unlock(&eval_cache_lock);
+
+	wake_up_all(&eval_cache_wait);
+
+	/* stale from here on, the waiters retry rather than see this */
+	if (ret == -ERESTARTSYS)
+		return ret;
+
+	return eval_cache_copy(new, buffer);
+}
+
+/*
+ * Parse the eval_cache parameter into eval_cache_names
+ */
+static void
+eval_cache_init(void)
+{
+	char		*names, *cur, *tok, *ms;
+	unsigned long	ttl;
+	u32		seg;
+	int		i;
+
+	for (i = 0 ; i < EVAL_CACHE_BUCKETS ; i++)
+		INIT_LIST_HEAD(&eval_cache_buckets[i]);
+
+	if (!eval_cache[0])
+		return;
+
+	names = strdup(eval_cache);
+	if (!names)
+		return;
+
+	cur = names;
+	while ((tok = strsep(&cur, ",")) != NULL) {
+		if (!*tok)
+			continue;
+
+		ttl = eval_cache_ttl;
+		ms = strchr(tok, ':');
+		if (ms) {
+			*ms++ = '\0';
+			ttl = simple_strtoul(ms, NULL, 10);
+		}
+
+		if (strlen(tok) > sizeof(seg) || !ttl ||
+		    eval_cache_name_count == EVAL_CACHE_NAMES_MAX) {
+			printk(KERN_WARNING "%s: ignoring eval_cache entry %s\n",
+			       DEV_ACPI_NAME, tok);
+			continue;
+		}
+
+		/* short names are padded with '_' in namespace */
+		memset(&seg, '_', sizeof(seg));
+		memcpy(&seg, tok, strlen(tok));
+
+		eval_cache_names[eval_cache_name_count].name = seg;
+		eval_cache_names[eval_cache_name_count].ttl =
+		                                       msecs_to_jiffies(ttl);
+		eval_cache_name_count++;
+	}
+	kfree(names);
+}
+
+static void
+eval_cache_exit(void)
+{
+	struct eval_cache_entry	*entry, *tmp;
+
+	list_for_each_entry_safe(entry, tmp, &eval_cache_lru, lru) {
+		kfree(entry->result);
+		kfree(entry);
+	}
+}
+
+/*
+ * Evaluate handle, leaving the result with pointers turned into offsets in
+ * buffer.  If buffer->pointer is set the result is put there, otherwise
+ * it's allocated.  buffer->length is 0 if nothing was returned.  Objects
+ * named by eval_cache are answered from the cache, the rest are scheduled
+ * in class cls.
+ */
+static int
+dev_acpi_evaluate(
+	acpi_handle		handle,
+	struct acpi_object_list	*args,
+	struct acpi_buffer	*buffer,
+	u32			cls)
+{
+	unsigned long	ttl;
+
+	ttl = eval_cache_lookup_ttl(handle);
+	if (ttl)
+		return eval_cache_evaluate(handle, args, buffer, cls, ttl);
+
+	return dev_acpi_evaluate_object(handle, args, buffer, cls);
+}
+
+/* dev_acpi_evaluate() without the cache */
+static int
+dev_acpi_evaluate_object(
+	acpi_handle		handle,
+	struct acpi_object_list	*args,
+	struct acpi_buffer	*buffer,
+	u32			cls)
+{
+	acpi_status	status;
+	int		allocated = 0;
+
+	if (!buffer->pointer) {
+		buffer->length = ACPI_ALLOCATE_BUFFER;
+		allocated = 1;
+	}
+
+	if (dev_acpi_sched_evaluate(cls, handle, args, buffer, &status))
+		return -ERESTARTSYS;
+
+	if (status == AE_BUFFER_OVERFLOW)
+		return -E2BIG;
+
+	if (ACPI_FAILURE(status))
+		return -ENOENT;
+
+	if (!buffer->pointer || !buffer->length) {
+		buffer->length = 0;
+		return 0;
+	}
+
+	if (fixup_element((union acpi_object *)buffer->pointer, buffer,
+	                  TO_OFFSET))
+		return 0;
+
+	if (!allocated)
+		return -EFAULT;
+
+	/* same as always, an unconvertible result reads as nothing */
+	kfree(buffer->pointer);
+	buffer->pointer = NULL;
+	buffer->length = 0;
+	return 0;
+}
+
+/* Operations on a single object, these take a pathname or a handle ID */
+/*
+ * DEV_ACPI_NOTIFY_SUBTREE walk state.  index counts every object in the
+ * same order as DEV_ACPI_GET_SUBTREE, the bitmap has a bit per object.
+ */
+struct notify_walk {
+	struct file			*f;
+	dev_acpi_notify_subtree_t	*data;
+	result_buf_t			bitmap;
+	u32				index;
+};
+
+static int
+dev_acpi_notify_is_dev(acpi_object_type type)
+{
+	return type == ACPI_TYPE_DEVICE || type == ACPI_TYPE_PROCESSOR ||
+	       type == ACPI_TYPE_THERMAL || type == ACPI_TYPE_POWER;
+}
+
+static int
+dev_acpi_notify_node(
+	struct notify_walk	*walk,
+	acpi_handle		handle)
+{
+	dev_acpi_notify_subtree_t	*data = walk->data;
+	priv_data_t			*priv;
+	acpi_object_type		type;
+	u32				i, bit, types[2];
+	int				ret;
+
+	bit = walk->index++;
+
+	if (!(bit % 8)) {
+		u8 zero = 0;
+
+		if (!result_buf_append(&walk->bitmap, &zero, 1))
+			return -ENOMEM;
+	}
+
+	/* a handler on the root gets every notify, that's not per object */
+	if (handle == ACPI_ROOT_OBJECT)
+		return 0;
+
+	if (ACPI_FAILURE(acpi_get_type(handle, &type)))
+		return 0;
+
+	if (data->type ? type != data->type : !dev_acpi_notify_is_dev(type))
+		return 0;
+
+	data->matched++;
+	priv = (priv_data_t *)walk->f->private_data;
+
+	types[0] = (data->flags & DEV_ACPI_NOTIFY_DEVICE) ?
+	           ACPI_DEVICE_NOTIFY : 0;
+	types[1] = (data->flags & DEV_ACPI_NOTIFY_SYSTEM) ?
+	           ACPI_SYSTEM_NOTIFY : 0;
+
+	for (i = 0 ; i < 2 ; i++) {
+		if (!types[i])
+			continue;
+
+		if (data->flags & DEV_ACPI_NOTIFY_REMOVE) {
+			/* only this file's subscriptions */
+			if (!dev_acpi_notify_find(priv, handle, types[i]))
+				continue;
+
+			ret = dev_acpi_notify_remove(walk->f, handle, types[i]);
+		} else
+			ret = dev_acpi_notify_install(walk->f, handle,
+			                              types[i]);
+
+		if (ret == -ENOMEM)
+			return ret;
+
+		if (!ret)
+			data->done++;
+		else if (ret == -EEXIST) {
+			data->exists++;
+			walk->bitmap.pointer[bit / 8] |= 1 << (bit % 8);
+		} else
+			data->failed++;
+	}
+	return 0;
+}
+
+static acpi_status
+dev_acpi_notify_subtree_callback(
+	acpi_handle	handle,
+	u32		depth,
+	void		*context,
+	void		**ret)
+{
+	if (dev_acpi_notify_node(context, handle))
+		return AE_NO_MEMORY;
+
+	return AE_OK;
+}
+
+/*
+ * Install or remove handlers on every matching object from handle down,
+ * the read buffer gets the -EEXIST bitmap.  On failure the handlers
+ * installed so far stay and are released with the file.
+ */
+static int
+dev_acpi_notify_subtree(
+	struct file			*f,
+	acpi_handle			handle,
+	dev_acpi_notify_subtree_t	*data)
+{
+	struct acpi_buffer	*rbuf = RBUF(f);
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct notify_walk	walk;
+	acpi_status		status;
+	int			ret;
+
+	if (!(data->flags & (DEV_ACPI_NOTIFY_DEVICE | DEV_ACPI_NOTIFY_SYSTEM)))
+		return -EINVAL;
+
+	data->count = data->matched = data->done = 0;
+	data->exists = data->failed = data->return_size = 0;
+
+	memset(&walk, 0, sizeof(walk));
+	walk.f = f;
+	walk.data = data;
+
+	ret = dev_acpi_notify_node(&walk, handle);
+
+	if (!ret) {
+		status = acpi_walk_namespace(ACPI_TYPE_ANY, handle,
+		                             SUBTREE_DEPTH_MAX,
+		                             dev_acpi_notify_subtree_callback,
+		                             &walk, NULL);
+		if (ACPI_FAILURE(status))
+			ret = (status == AE_NO_MEMORY) ? -ENOMEM : -EFAULT;
+	}
+
+	if (data->flags & DEV_ACPI_NOTIFY_REMOVE)
+		wake_up_interruptible(&priv->wait);
+
+	if (ret) {
+		result_buf_free(&walk.bitmap);
+		return ret;
+	}
+
+	data->count = walk.index;
+
+	if (!result_buf_finish(&walk.bitmap, rbuf, 0))
+		return -ENOMEM;
+
+	data->return_size = rbuf->length;
+	return 0;
+}
+
+static int
+dev_acpi_is_handle_op(unsigned int cmd)
+{
+	switch (cmd) {
+	case DEV_ACPI_EXISTS:
+	case DEV_ACPI_GET_TYPE:
+	case DEV_ACPI_EVALUATE_OBJ:
+	case DEV_ACPI_EVALUATE_MMAP:
+	case DEV_ACPI_GET_NEXT:
+	case DEV_ACPI_GET_NEXT_NODES:
+	case DEV_ACPI_GET_PARENT:
+	case DEV_ACPI_GET_SUBTREE:
+	case DEV_ACPI_GET_DEVICE_INFO:
+	case DEV_ACPI_DEVICE_NOTIFY:
+	case DEV_ACPI_SYSTEM_NOTIFY:
+	case DEV_ACPI_REMOVE_DEVICE_NOTIFY:
+	case DEV_ACPI_REMOVE_SYSTEM_NOTIFY:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Buffers to clear before a handle op, evaluate takes its arguments from
+ * the write buffer */
+static int
+dev_acpi_op_clear(unsigned int cmd)
+{
+	if (cmd == DEV_ACPI_EVALUATE_OBJ || cmd == DEV_ACPI_EVALUATE_MMAP)
+		return READ_CLEAR;
+
+	return READ_CLEAR | WRITE_CLEAR;
+}
+
+/* Does a handle op leave data to read() */
+static int
+dev_acpi_op_readable(unsigned int cmd)
+{
+	return (_IOC_DIR(cmd) & _IOC_READ) && cmd != DEV_ACPI_EVALUATE_MMAP;
+}
+
+/*
+ * Do cmd on handle.  Any data returned is left in the read buffer with
+ * its size in *return_size.
+ */
+static int
+dev_acpi_handle_op(
+	struct file	*f,
+	unsigned int	cmd,
 	acpi_handle	handle,
-	u32		depth,
-	void		*context,
-	void		**ret)
+	u32		*return_size)
 {
-	struct acpi_buffer	*ret_buf;
-	acpi_status		status;
-	size_t			new_size;
-	char			*new_buf, *name, pathname[ACPI_PATHNAME_MAX];
-	struct acpi_buffer	buffer = {ACPI_PATHNAME_MAX, pathname};
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*rbuf = RBUF(f);
 
-	ret_buf = *ret;
+	*return_size = 0;
 
-	memset(pathname, 0, sizeof(pathname));
-	name = (char *)context;
+	if (cmd == DEV_ACPI_EXISTS) {
+		return 0;
 
-	/*
-	 * First get the single name to see if this is what we're looking
-	 * for.  If it is, get the full path.
-	 */
-	status = acpi_get_name(handle, ACPI_SINGLE_NAME, &buffer);
+	} else if (cmd == DEV_ACPI_GET_TYPE) {
+		acpi_object_type	type;
+		union acpi_object	*obj;
 
-	if (ACPI_FAILURE(status))
-		return status;
+		if (ACPI_FAILURE(acpi_get_type(handle, &type)))
+			return -EFAULT;
 
-	if (strcmp(name, pathname))
-		return AE_OK; /* Not it */
+		rbuf->pointer = kmalloc(sizeof(*obj), GFP_KERNEL);
 
-	memset(pathname, 0, sizeof(pathname));
-	buffer.length = sizeof(pathname);
+		if (!rbuf->pointer)
+			return -ENOMEM;
 
-	status = acpi_get_name(handle, ACPI_FULL_PATHNAME, &buffer);
+		memset(rbuf->pointer, 0, sizeof(*obj));
+		rbuf->length = sizeof(*obj);
 
-	if (ACPI_FAILURE(status))
-		return status;
+		obj = rbuf->pointer;
+		obj->type = ACPI_TYPE_INTEGER;
+		obj->integer.value = type;
 
-	/*
-	 * length includes terminator, which we'll replace
-	 * with a line feed.
-	 */
-	new_size = buffer.length + ret_buf->length;
-	new_buf = kmalloc(new_size, GFP_KERNEL);
+		*return_size = rbuf->length;
+		return 0;
 
-	if (!new_buf)
-		return AE_NO_MEMORY;
+	} else if (cmd == DEV_ACPI_EVALUATE_OBJ ||
+	           cmd == DEV_ACPI_EVALUATE_MMAP) {
+		struct acpi_object_list	*args;
+		struct acpi_buffer	*wbuf;
+		struct acpi_buffer	buffer = {0, NULL};
+		int			ret;
 
-	memset(new_buf, 0, new_size);
+		args = NULL;
+		wbuf = WBUF(f);
 
-	sprintf(new_buf, "%s%s\n", (char *)ret_buf->pointer, pathname);
+		/*
+		 * Result goes straight into the mmap'd area.  There's one
+		 * per fd, per-thread callers would overwrite each other's.
+		 */
+		if (cmd == DEV_ACPI_EVALUATE_MMAP) {
+			spin_lock(&priv->lock);
+			buffer.pointer = priv->area;
+			buffer.length = priv->area_size;
+			ret = priv->per_thread ? -EBUSY :
+			      !buffer.pointer ? -ENXIO : 0;
+			spin_unlock(&priv->lock);
+
+			if (ret) {
+				dev_acpi_clear(f, WRITE_CLEAR);
+				return ret;
+			}
+		}
 
-	kfree(ret_buf->pointer);
+		/* check for object list in write buffer */
+		if (wbuf->pointer && wbuf->length >=
+		                     sizeof(struct acpi_object_list) +
+		                     sizeof(union acpi_object)) {
 
-	ret_buf->pointer = new_buf;
-	ret_buf->length = new_size;
+			args = fixup_arglist(wbuf);
+			if (!args) {
+				dev_acpi_clear(f, WRITE_CLEAR);
+				return -EINVAL;
+			}
+		}
 
-	return AE_OK;
-}
+		ret = dev_acpi_evaluate(handle, args, &buffer,
+		                        priv->eval_class);
 
-static acpi_status
-dev_acpi_get_objects(char *name, struct acpi_buffer *buffer)
-{
-	acpi_status status;
+		dev_acpi_clear(f, WRITE_CLEAR);
 
-	if (buffer->length || buffer->pointer)
-		return AE_ALREADY_EXISTS;
+		if (ret)
+			return ret;
 
-	/* Setup the string terminator, then just push it along */
-	buffer->pointer = kmalloc(1, GFP_KERNEL);
+		*return_size = buffer.length;
 
-	if (!buffer->pointer)
-		return AE_NO_MEMORY;
+		if (cmd == DEV_ACPI_EVALUATE_OBJ) {
+			rbuf->pointer = buffer.pointer;
+			rbuf->length = buffer.length;
+		}
+		return 0;
 
-	buffer->length = 1;
-	memset(buffer->pointer, 0, 1);
+	/* List of child objects for a path */
+	} else if (cmd == DEV_ACPI_GET_NEXT) {
 
-	status = acpi_walk_namespace(ACPI_TYPE_ANY,
-	                             ACPI_ROOT_OBJECT,
-	                             ACPI_UINT32_MAX,
-	                             dev_acpi_get_objects_callback,
-	                             (void *)name,
-	                             (void **)&buffer);
-	
-	if (ACPI_FAILURE(status) || buffer->length == 1) {
-		kfree(buffer->pointer);
-		buffer->length = 0;
-		buffer->pointer = NULL;
-		if (buffer->length == 1)
-			status = AE_NOT_FOUND;
-	}
-	return status;
-}
+		if (ACPI_FAILURE(dev_acpi_get_next(handle, rbuf)))
+			return -EFAULT;
 
-static ssize_t
-dev_acpi_read(
-	struct file	*f,
-	char __user	*buf,
-	size_t		len,
-	loff_t		*off)
-{
-	unsigned char		*copy_addr;
-	size_t			copy_len;
-	struct acpi_buffer	*buffer;
-	priv_data_t		*priv;
+		*return_size = rbuf->length;
+		return 0;
 
-	priv = (priv_data_t *)f->private_data;
+	/* Same as above, binary records with type and child count */
+	} else if (cmd == DEV_ACPI_GET_NEXT_NODES) {
 
-try_again:
-	if (down_trylock(&priv->sem)) {
-		if (f->f_flags & O_NONBLOCK)
-			return -EAGAIN;
-		if (down_interruptible(&priv->sem))
-			return -ERESTARTSYS;
-	}
+		if (ACPI_FAILURE(dev_acpi_get_next_nodes(handle, rbuf)))
+			return -EFAULT;
 
-	buffer = RBUF(f);
+		*return_size = rbuf->length;
+		return 0;
 
-	if (!buffer->length || !buffer->pointer) {
-		/*
-		 * If notifiers are setup, allow the reader to wait for data.
-		 * Otherwise, there's none here now an none on the way.
-		 */
-		if (list_empty(&priv->notify)) {
-			up(&priv->sem);
-			return -ENODEV;
-		}
-		goto try_again;
-	}
+	/* Everything below a path, binary records in preorder */
+	} else if (cmd == DEV_ACPI_GET_SUBTREE) {
 
-	up(&priv->sem);
+		if (ACPI_FAILURE(dev_acpi_get_subtree(handle, rbuf)))
+			return -EFAULT;
 
-	if (*off > buffer->length)
-		return -EFAULT;
+		*return_size = rbuf->length;
+		return 0;
 
-	copy_addr = buffer->pointer + *off;
-	copy_len = min((size_t)(buffer->length - *off), len);
+	/* Identification objects, one binary record */
+	} else if (cmd == DEV_ACPI_GET_DEVICE_INFO) {
 
-	if (copy_to_user(buf, copy_addr, copy_len))
-		return -EFAULT;
+		if (ACPI_FAILURE(dev_acpi_get_device_info(handle, rbuf)))
+			return -EFAULT;
 
-	return copy_len;
-}
+		*return_size = rbuf->length;
+		return 0;
 
-static ssize_t
-dev_acpi_write(
-	struct file		*f,
-	const char __user	*buf,
-	size_t			len,
-	loff_t			*off)
-{
-	unsigned char		*start;
-	struct acpi_buffer	*buffer;
+	} else if (cmd == DEV_ACPI_GET_PARENT) {
+		acpi_handle		phandle;
+		char			pathname[ACPI_PATHNAME_MAX];
+		struct acpi_buffer	strbuf = {ACPI_PATHNAME_MAX, pathname};
 
-	buffer = WBUF(f);
+		memset(pathname, 0, sizeof(pathname));
 
-	if (len + *off > buffer->length) {
-		void *new_buf;
+		if (ACPI_FAILURE(acpi_get_parent(handle, &phandle)))
+			return -EFAULT;
 
-		new_buf = kmalloc(len + *off, GFP_KERNEL);
+		if (ACPI_FAILURE(acpi_get_name(phandle, ACPI_FULL_PATHNAME,
+		                               &strbuf)))
+			return -EFAULT;
 
-		if (!new_buf)
-			return -ENOMEM;
+		rbuf->pointer = strdup(pathname);
 
-		memset(new_buf, 0, len + *off);
+		if (!rbuf->pointer)
+			return -ENOMEM;
 
-		if (buffer->length && buffer->pointer)
-			memcpy(new_buf, buffer->pointer, buffer->length);
+		*return_size = rbuf->length = strlen(pathname) + 1;
+		return 0;
 
-		kfree(buffer->pointer);
+	} else if (cmd == DEV_ACPI_DEVICE_NOTIFY ||
+	           cmd == DEV_ACPI_SYSTEM_NOTIFY) {
 
-		buffer->pointer = new_buf;
-		buffer->length = len + *off;
-	}
+		return dev_acpi_notify_install(f, handle,
+		                               (cmd == DEV_ACPI_SYSTEM_NOTIFY) ?
+		                               ACPI_SYSTEM_NOTIFY :
+		                               ACPI_DEVICE_NOTIFY);
 
-	start = buffer->pointer + *off;
+	} else if (cmd == DEV_ACPI_REMOVE_DEVICE_NOTIFY ||
+	           cmd == DEV_ACPI_REMOVE_SYSTEM_NOTIFY) {
+		int	ret;
 
-	if (copy_from_user(start, buf, len))
-		return -EFAULT;
+		ret = dev_acpi_notify_remove(f, handle,
+		                          (cmd == DEV_ACPI_REMOVE_SYSTEM_NOTIFY) ?
+		                          ACPI_SYSTEM_NOTIFY : ACPI_DEVICE_NOTIFY);
 
-	return len;
+		/* readers blocked on the last notifier need to bail out */
+		if (!ret)
+			wake_up_interruptible(&priv->wait);
+		return ret;
+	}
+	return -EINVAL;
 }
 
-static void
-dev_acpi_notify(
-	acpi_handle	handle,
-	u32		event,
-	void		*data)
+/* One DEV_ACPI_BATCH operation, result data is left in out */
+static int
+dev_acpi_batch_op(
+	struct file		*f,
+	dev_acpi_batch_op_t	*op,
+	struct acpi_buffer	*out)
 {
-	struct file		*f;
-	priv_data_t		*priv;
-	char			*str;
-	int			size;
-	char			pathname[ACPI_PATHNAME_MAX];
-	struct acpi_buffer	*buffer, strbuf = {ACPI_PATHNAME_MAX, pathname};
-	
-	f = (struct file *)data;
-	priv = (priv_data_t *)f->private_data;
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*rbuf = RBUF(f);
+	acpi_handle		handle;
+	union acpi_object	args[DEV_ACPI_FAST_ARGS];
+	struct acpi_object_list	arg_list = {0, args};
+	u32			i, size;
+	int			ret;
 
-	memset(pathname, 0, sizeof(pathname));
+	if (!dev_acpi_is_handle_op(op->cmd) ||
+	    op->cmd == DEV_ACPI_EVALUATE_MMAP ||
+	    op->arg_count > DEV_ACPI_FAST_ARGS)
+		return -EINVAL;
 
-	if (ACPI_FAILURE(acpi_get_name(handle, ACPI_FULL_PATHNAME, &strbuf)))
-		sprintf(pathname, "????");
+	if (op->id)
+		handle = dev_acpi_id_handle(priv, op->id, op->pathname,
+		                            sizeof(op->pathname));
+	else
+		handle = dev_acpi_get_handle(op->pathname);
 
-	size = strlen(pathname) + 10; /* see sprintf below */
-	str = kmalloc(size, GFP_KERNEL);
+	if (!handle)
+		return -ENOENT;
 
-	if (!str) {
-		printk(KERN_WARNING "%s() kmalloc failed, event %s,%08x lost\n",
-		       __FUNCTION__, pathname, event);
-		return;
-	}
+	if (op->cmd == DEV_ACPI_EVALUATE_OBJ) {
+		memset(args, 0, sizeof(args));
+
+		for (i = 0 ; i < op->arg_count ; i++) {
+			args[i].type = ACPI_TYPE_INTEGER;
+			args[i].integer.value = op->args[i];
+		}
+		arg_list.count = op->arg_count;
 
-	memset(str, 0, size);
-	dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
+		return dev_acpi_evaluate(handle,
+		                         op->arg_count ? &arg_list : NULL, out,
+		                         priv->eval_class);
+	}
 
-	sprintf(str, "%s,%08x", pathname, event);
+	/* Everything else leaves its result in the read buffer */
+	ret = dev_acpi_handle_op(f, op->cmd, handle, &size);
 
-	buffer = RBUF(f);
-	buffer->pointer = str;
-	buffer->length = size;
+	if (!ret) {
+		out->pointer = rbuf->pointer;
+		out->length = rbuf->length;
+		rbuf->pointer = NULL;
+		rbuf->length = 0;
+	}
 
-	up(&priv->sem);
+	dev_acpi_clear(f, READ_CLEAR);
+	return ret;
 }
 
+/*
+ * Run the operations in the write buffer, results go to the read buffer.
+ * A failing operation doesn't stop the batch, its status says why.
+ */
 static int
-dev_acpi_open(
-	struct inode	*i,
-	struct file	*f)
+dev_acpi_batch(
+	struct file	*f,
+	u32		count)
 {
-	priv_data_t	*priv;
+	struct acpi_buffer	*wbuf = WBUF(f);
+	struct acpi_buffer	*rbuf = RBUF(f);
+	dev_acpi_batch_op_t	*ops;
+	dev_acpi_batch_result_t	*res;
+	result_buf_t		rb = {NULL, 0, 0};
+	u32			i, offset;
+	int			ret;
 
-	if (!try_module_get(THIS_MODULE))
-		return -EBUSY;
+	if (!count || count > BATCH_OPS_MAX || !wbuf->pointer ||
+	    wbuf->length < count * sizeof(*ops))
+		return -EINVAL;
 
-	f->private_data = kmalloc(sizeof(priv_data_t), GFP_KERNEL);
-	if (!f->private_data) {
-		module_put(THIS_MODULE);
+	ops = wbuf->pointer;
+
+	if (!result_buf_reserve(&rb, count * sizeof(*res)))
 		return -ENOMEM;
-	}
 
-	memset(f->private_data, 0, sizeof(priv_data_t));
+	memset(rb.pointer, 0, count * sizeof(*res));
+	rb.length = count * sizeof(*res);
 
-	priv = (priv_data_t *)f->private_data;
-	sema_init(&priv->sem, 1);
-	INIT_LIST_HEAD(&priv->notify);
-	return 0;
-}
+	for (i = 0 ; i < count ; i++) {
+		struct acpi_buffer out = {0, NULL};
 
-static int
-dev_acpi_release(
-	struct inode	*i,
-	struct file	*f)
-{
-	struct list_head	*list;
-	struct notify_list	*notify;
-	priv_data_t		*priv = (priv_data_t *)f->private_data;
+		ret = dev_acpi_batch_op(f, &ops[i], &out);
+		offset = 0;
 
-	list = &priv->notify;
-	while (!list_empty(list)) {
-		notify = list_entry(list->next, struct notify_list, node);
-		if (notify->device && notify->type)
-			acpi_remove_notify_handler(notify->device, notify->type,
-			                           dev_acpi_notify);
+		if (!ret && out.length) {
+			/* objects contain 64bit integers, keep them aligned */
+			offset = (rb.length + 7) & ~7;
+
+			if (!result_buf_reserve(&rb, offset - rb.length +
+			                             out.length)) {
+				kfree(out.pointer);
+				result_buf_free(&rb);
+				return -ENOMEM;
+			}
+
+			memset(rb.pointer + rb.length, 0, offset - rb.length);
+			memcpy(rb.pointer + offset, out.pointer, out.length);
+			rb.length = offset + out.length;
+		}
+		kfree(out.pointer);
 
-		list_del(&notify->node);
-		kfree(notify);
+		res = (dev_acpi_batch_result_t *)rb.pointer + i;
+		res->status = -ret;
+		res->cmd = ops[i].cmd;
+		res->offset = offset;
+		res->length = offset ? out.length : 0;
 	}
 
-	dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
-	kfree(f->private_data);
-	module_put(THIS_MODULE);
+	rbuf->pointer = rb.pointer;
+	rbuf->length = rb.length;
 	return 0;
 }
 
 static int
-dev_acpi_ioctl(
-	struct inode	*i,
+dev_acpi_do_ioctl(
 	struct file	*f,
 	unsigned int	cmd,
 	unsigned long	arg)
@@ -793,32 +4820,89 @@ dev_acpi_ioctl(
 	priv_data_t *priv = (priv_data_t *)f->private_data;
 
 	/* Do stuff... */
-	if (cmd == DEV_ACPI_EXISTS) {
+	if (dev_acpi_is_handle_op(cmd)) {
 		dev_acpi_t	data;
 		acpi_handle	handle;
+		int		ret;
 
-		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
+		dev_acpi_clear(f, dev_acpi_op_clear(cmd));
 
-		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
+		/* don't leave arguments behind on failure */
+		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data))) {
+			dev_acpi_clear(f, WRITE_CLEAR);
 			return -EFAULT;
+		}
 
 		handle = dev_acpi_get_handle(data.pathname);
 
-		if (!handle)
-			return -ENOENT;
+		if (!handle) {
+			dev_acpi_clear(f, WRITE_CLEAR);
+			return -ENOENT;
+		}
+
+		ret = dev_acpi_handle_op(f, cmd, handle, &data.return_size);
+
+		if (ret || !(_IOC_DIR(cmd) & _IOC_READ))
+			return ret;
+
+		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
+			dev_acpi_clear(f, READ_CLEAR);
+			return -EFAULT;
+		}
+
+		if (dev_acpi_op_readable(cmd))
+			dev_acpi_ready(f);
+		return 0;
+
+	} else if (cmd == DEV_ACPI_BY_ID) {
+		dev_acpi_id_t	data;
+		acpi_handle	handle;
+		int		ret;
+
+		if (copy_from_user(&data, (dev_acpi_id_t *)arg, sizeof(data))) {
+			dev_acpi_clear(f, WRITE_CLEAR);
+			return -EFAULT;
+		}
+
+		if (!dev_acpi_is_handle_op(data.cmd)) {
+			dev_acpi_clear(f, WRITE_CLEAR);
+			return -EINVAL;
+		}
+
+		dev_acpi_clear(f, dev_acpi_op_clear(data.cmd));
+
+		handle = dev_acpi_id_handle(priv, data.id, data.name,
+		                            sizeof(data.name));
+
+		if (!handle) {
+			dev_acpi_clear(f, WRITE_CLEAR);
+			return -ENOENT;
+		}
+
+		ret = dev_acpi_handle_op(f, data.cmd, handle,
+		                         &data.return_size);
+
+		if (ret)
+			return ret;
+
+		if (copy_to_user((dev_acpi_id_t *)arg, &data, sizeof(data))) {
+			dev_acpi_clear(f, READ_CLEAR);
+			return -EFAULT;
+		}
 
+		if (dev_acpi_op_readable(data.cmd))
+			dev_acpi_ready(f);
 		return 0;
 
-	} else if (cmd == DEV_ACPI_GET_TYPE) {
-		dev_acpi_t		data;
-		acpi_handle		handle;
-		acpi_object_type	type;
-		struct acpi_buffer	*buffer;
-		union acpi_object	*obj;
+	} else if (cmd == DEV_ACPI_NOTIFY_SUBTREE) {
+		dev_acpi_notify_subtree_t	data;
+		acpi_handle			handle;
+		int				ret;
 
 		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
 
-		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
+		if (copy_from_user(&data, (dev_acpi_notify_subtree_t *)arg,
+		                   sizeof(data)))
 			return -EFAULT;
 
 		handle = dev_acpi_get_handle(data.pathname);
@@ -826,120 +4910,133 @@ dev_acpi_ioctl(
 		if (!handle)
 			return -ENOENT;
 
-		if (ACPI_FAILURE(acpi_get_type(handle, &type)))
-			return -EFAULT;
-
-		buffer = RBUF(f);
-		buffer->pointer = kmalloc(sizeof(*obj), GFP_KERNEL);
-
-		if (!buffer->pointer)
-			return -ENOMEM;
+		ret = dev_acpi_notify_subtree(f, handle, &data);
 
-		memset(buffer->pointer, 0, sizeof(*obj));
-		buffer->length = sizeof(*obj);
-
-		obj = buffer->pointer;
-		obj->type = ACPI_TYPE_INTEGER;
-		obj->integer.value = type;
+		if (ret)
+			return ret;
 
-		data.return_size = buffer->length;
-		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
+		if (copy_to_user((dev_acpi_notify_subtree_t *)arg, &data,
+		                 sizeof(data))) {
 			dev_acpi_clear(f, READ_CLEAR);
 			return -EFAULT;
 		}
 
-		up(&priv->sem);
+		dev_acpi_ready(f);
 		return 0;
 
-	} else if (cmd == DEV_ACPI_EVALUATE_OBJ) {
-		dev_acpi_t		data;
-		acpi_handle		handle;
-		struct acpi_object_list	*args;
-		acpi_status		status;
-		struct acpi_buffer	*wbuf, *rbuf;
-		struct acpi_buffer	buffer = {ACPI_ALLOCATE_BUFFER, NULL};
+	} else if (cmd == DEV_ACPI_ASYNC_SUBMIT ||
+	           cmd == DEV_ACPI_ASYNC_REAP) {
+
+		dev_acpi_async_t	data;
+		int			ret;
 
 		dev_acpi_clear(f, READ_CLEAR);
 
-		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
+		if (copy_from_user(&data, (dev_acpi_async_t *)arg,
+		                   sizeof(data))) {
+			dev_acpi_clear(f, WRITE_CLEAR);
 			return -EFAULT;
+		}
 
-		handle = dev_acpi_get_handle(data.pathname);
+		if (cmd == DEV_ACPI_ASYNC_SUBMIT) {
+			ret = dev_acpi_async_submit(f, data.count);
+			dev_acpi_clear(f, WRITE_CLEAR);
+		} else
+			ret = dev_acpi_async_reap(f, data.count);
 
-		if (!handle)
-			return -ENOENT;
+		if (ret < 0)
+			return ret;
 
-		args = NULL;
-		wbuf = WBUF(f);
-		rbuf = RBUF(f);
+		data.count = ret;
+		data.return_size = RBUF(f)->length;
 
-		/* check for object list in write buffer */
-		if (wbuf->pointer && wbuf->length >=
-		                     sizeof(struct acpi_object_list) +
-		                     sizeof(union acpi_object)) {
+		if (copy_to_user((dev_acpi_async_t *)arg, &data,
+		                 sizeof(data))) {
+			dev_acpi_clear(f, READ_CLEAR);
+			return -EFAULT;
+		}
 
-			args = fixup_arglist(wbuf);
-			if (!args) {
-				dev_acpi_clear(f, WRITE_CLEAR);
-				return -EINVAL;
-			}
+		if (data.return_size)
+			dev_acpi_ready(f);
+		return 0;
+
+	} else if (cmd == DEV_ACPI_BATCH) {
+		dev_acpi_batch_t	data;
+		int			ret;
+
+		dev_acpi_clear(f, READ_CLEAR);
+
+		if (copy_from_user(&data, (dev_acpi_batch_t *)arg,
+		                   sizeof(data))) {
+			dev_acpi_clear(f, WRITE_CLEAR);
+			return -EFAULT;
 		}
 
-		status = acpi_evaluate_object(handle, NULL, args, &buffer);
+		ret = dev_acpi_batch(f, data.count);
 
 		dev_acpi_clear(f, WRITE_CLEAR);
 
-		if (ACPI_FAILURE(status))
-			return -ENOENT;
-
-		data.return_size = 0;
+		if (ret)
+			return ret;
 
-		if (buffer.pointer)  {
-			if (fixup_element((union acpi_object *)buffer.pointer,
-			                  &buffer, TO_OFFSET)) {
-				rbuf->length = data.return_size = buffer.length;
-				rbuf->pointer = buffer.pointer;
-			} else
-				kfree(buffer.pointer);
-		}
+		data.return_size = RBUF(f)->length;
 
-		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
+		if (copy_to_user((dev_acpi_batch_t *)arg, &data,
+		                 sizeof(data))) {
 			dev_acpi_clear(f, READ_CLEAR);
 			return -EFAULT;
 		}
 
-		up(&priv->sem);
+		dev_acpi_ready(f);
 		return 0;
 
-	/* List of child objects for a path */
-	} else if (cmd == DEV_ACPI_GET_NEXT) {
-		dev_acpi_t			data;
-		acpi_handle			handle;
-		struct acpi_buffer		*buffer = RBUF(f);
-
-		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
+	} else if (cmd == DEV_ACPI_EVAL_FAST) {
+		dev_acpi_eval_fast_t	fast;
+		int			ret;
 
-		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
+		if (copy_from_user(&fast, (dev_acpi_eval_fast_t *)arg,
+		                   sizeof(fast)))
 			return -EFAULT;
 
-		handle = dev_acpi_get_handle(data.pathname);
+		ret = dev_acpi_eval_fast(priv, &fast);
 
-		if (!handle)
-			return -ENOENT;
+		if (ret && ret != -E2BIG)
+			return ret;
 
-		if (ACPI_FAILURE(dev_acpi_get_next(handle, buffer)))
+		/* type is still useful when the result didn't fit */
+		if (copy_to_user((dev_acpi_eval_fast_t *)arg, &fast,
+		                 sizeof(fast)))
 			return -EFAULT;
+		return ret;
 
-		data.return_size = buffer->length;
+	} else if (cmd == DEV_ACPI_OPEN_HANDLE) {
+		dev_acpi_t	data;
+		int		id;
+
+		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
+			return -EFAULT;
+
+		id = dev_acpi_id_open(priv, data.pathname);
+
+		if (id < 0)
+			return id;
+
+		data.return_size = id;
 
 		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
-			dev_acpi_clear(f, READ_CLEAR);
+			dev_acpi_id_close(priv, id);
 			return -EFAULT;
 		}
-
-		up(&priv->sem);
 		return 0;
 
+	} else if (cmd == DEV_ACPI_CLOSE_HANDLE) {
+		dev_acpi_id_t	data;
+
+		if (copy_from_user(&data, (dev_acpi_id_t *)arg, sizeof(data)))
+			return -EFAULT;
+
+		return dev_acpi_id_close(priv, data.id);
+
 	} else if (cmd == DEV_ACPI_CLEAR) {
 		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
 		return 0;
@@ -947,7 +5044,8 @@ dev_acpi_ioctl(
 	 * Given a HID/CID value as the path, return a list of paths
 	 * with the requested ID
 	 */
-	} else if (cmd == DEV_ACPI_GET_DEVICES) {
+	} else if (cmd == DEV_ACPI_GET_DEVICES ||
+	           cmd == DEV_ACPI_GET_DEVICES_EXT) {
 		dev_acpi_t			data;
 		struct acpi_buffer		*buffer = RBUF(f);
 
@@ -956,7 +5054,8 @@ dev_acpi_ioctl(
 		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
 			return -EFAULT;
 
-		if (ACPI_FAILURE(dev_acpi_get_devices(data.pathname, buffer)))
+		if (ACPI_FAILURE(dev_acpi_get_devices(data.pathname, buffer,
+		                          cmd == DEV_ACPI_GET_DEVICES_EXT)))
 			return -EFAULT;
 
 		data.return_size = buffer->length;
@@ -965,7 +5064,7 @@ dev_acpi_ioctl(
 			dev_acpi_clear(f, READ_CLEAR);
 			return -EFAULT;
 		}
-		up(&priv->sem);
+		dev_acpi_ready(f);
 		return 0;
 
 	} else if (cmd == DEV_ACPI_GET_OBJECTS) {
@@ -986,47 +5085,7 @@ dev_acpi_ioctl(
 			dev_acpi_clear(f, READ_CLEAR);
 			return -EFAULT;
 		}
-		up(&priv->sem);
-		return 0;
-
-	} else if (cmd == DEV_ACPI_GET_PARENT) {
-		dev_acpi_t		data;
-		acpi_handle		handle, phandle;
-		struct acpi_buffer	*buffer;
-		char			pathname[ACPI_PATHNAME_MAX];
-		struct acpi_buffer	strbuf = {ACPI_PATHNAME_MAX, pathname};
-
-		memset(pathname, 0, sizeof(pathname));
-		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
-
-		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
-			return -EFAULT;
-
-		handle = dev_acpi_get_handle(data.pathname);
-
-		if (!handle)
-			return -ENOENT;
-
-		if (ACPI_FAILURE(acpi_get_parent(handle, &phandle)))
-			return -EFAULT;
-
-		if (ACPI_FAILURE(acpi_get_name(phandle, ACPI_FULL_PATHNAME,
-		                               &strbuf)))
-			return -EFAULT;
-
-		buffer = RBUF(f);
-		buffer->pointer = strdup(pathname);
-
-		if (!buffer->pointer)
-			return -ENOMEM;
-
-		data.return_size = buffer->length = strlen(pathname) + 1;
-
-		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
-			dev_acpi_clear(f, READ_CLEAR);
-			return -EFAULT;
-		}
-		up(&priv->sem);
+		dev_acpi_ready(f);
 		return 0;
 
 	} else if (cmd == DEV_ACPI_SYS_INFO) {
@@ -1050,94 +5109,277 @@ dev_acpi_ioctl(
 			dev_acpi_clear(f, READ_CLEAR);
 			return -EFAULT;
 		}
-		up(&priv->sem);
+		dev_acpi_ready(f);
 		return 0;
 #else
 		return -EINVAL;
 #endif
-	} else if (cmd == DEV_ACPI_DEVICE_NOTIFY ||
-	           cmd == DEV_ACPI_SYSTEM_NOTIFY) {
+	} else if (cmd == DEV_ACPI_EVENT_CONFIG) {
+
+		dev_acpi_event_config_t	config;
+		int			ret;
+
+		if (copy_from_user(&config, (dev_acpi_event_config_t *)arg,
+		                   sizeof(config)))
+			return -EFAULT;
+
+		if ((config.flags & DEV_ACPI_EVENT_BINARY) &&
+		    (config.flags & DEV_ACPI_EVENT_TEXT))
+			return -EINVAL;
+
+		if (config.depth) {
+			ret = dev_acpi_event_ring(priv, config.depth);
+			if (ret)
+				return ret;
+		}
+
+		spin_lock(&priv->lock);
+		if (config.flags & DEV_ACPI_EVENT_BINARY)
+			priv->ev_binary = 1;
+		else if (config.flags & DEV_ACPI_EVENT_TEXT)
+			priv->ev_binary = 0;
+
+		config.depth = priv->events ? priv->ev_depth : event_depth;
+		config.queued = priv->ev_count;
+		config.overflows = priv->ev_overflows;
+		config.flags = priv->ev_binary ? DEV_ACPI_EVENT_BINARY :
+		                                 DEV_ACPI_EVENT_TEXT;
+		spin_unlock(&priv->lock);
+
+		if (copy_to_user((dev_acpi_event_config_t *)arg, &config,
+		                 sizeof(config)))
+			return -EFAULT;
+		return 0;
+
+	} else if (cmd == DEV_ACPI_GET_NOTIFIERS) {
 
 		dev_acpi_t		data;
-		acpi_handle		handle;
-		acpi_status		status;
+		dev_acpi_notifier_t	rec;
 		struct notify_list	*entry;
-		u32			type;
+		struct list_head	*node;
+		result_buf_t		rb = {NULL, 0, 0};
 
 		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
 
 		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
 			return -EFAULT;
 
-		handle = dev_acpi_get_handle(data.pathname);
+		down(&priv->subs_sem);
 
-		if (!handle)
-			return -ENOENT;
+		list_for_each(node, &priv->notify) {
+			entry = list_entry(node, struct notify_list, node);
+
+			memset(&rec, 0, sizeof(rec));
+			rec.id = entry->id;
+			rec.type = entry->type;
+			strncpy(rec.pathname, entry->source->pathname,
+			        sizeof(rec.pathname) - 1);
+
+			spin_lock(&priv->lock);
+			memcpy(rec.mask, entry->mask, sizeof(rec.mask));
+			rec.window_ms = entry->window_ms;
+			rec.delivered = entry->delivered;
+			rec.filtered = entry->filtered;
+			rec.coalesced = entry->coalesced;
+			rec.overflows = entry->overflows;
+			spin_unlock(&priv->lock);
+
+			if (!result_buf_append(&rb, &rec, sizeof(rec))) {
+				up(&priv->subs_sem);
+				result_buf_free(&rb);
+				return -ENOMEM;
+			}
+		}
 
-		entry = kmalloc(sizeof(*entry), GFP_KERNEL);
+		up(&priv->subs_sem);
 
-		if (!entry)
+		if (!result_buf_finish(&rb, RBUF(f), 0))
 			return -ENOMEM;
 
-		memset(entry, 0, sizeof(*entry));
+		data.return_size = RBUF(f)->length;
+
+		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
+			dev_acpi_clear(f, READ_CLEAR);
+			return -EFAULT;
+		}
 
-		type = (cmd == DEV_ACPI_SYSTEM_NOTIFY) ?
-		       ACPI_SYSTEM_NOTIFY : ACPI_DEVICE_NOTIFY;
+		if (data.return_size)
+			dev_acpi_ready(f);
+		return 0;
 
-		status = acpi_install_notify_handler(handle, type,
-		                                     dev_acpi_notify, f);
+	} else if (cmd == DEV_ACPI_NOTIFY_FILTER) {
 
-		if (ACPI_FAILURE(status)) {
-			kfree(entry);
-			if (status == AE_ALREADY_EXISTS)
-				return -EEXIST;
-			return -EIO;
+		dev_acpi_notify_filter_t	filter;
+		struct notify_list		*entry;
+		struct list_head		*node;
+		int				found = 0;
+
+		if (copy_from_user(&filter, (dev_acpi_notify_filter_t *)arg,
+		                   sizeof(filter)))
+			return -EFAULT;
+
+		if (filter.window_ms > NOTIFY_WINDOW_MAX)
+			return -EINVAL;
+
+		down(&priv->subs_sem);
+
+		list_for_each(node, &priv->notify) {
+			entry = list_entry(node, struct notify_list, node);
+
+			if (filter.id && entry->id != filter.id)
+				continue;
+
+			spin_lock(&priv->lock);
+			memcpy(entry->mask, filter.mask, sizeof(entry->mask));
+			entry->window_ms = filter.window_ms;
+			spin_unlock(&priv->lock);
+			found = 1;
 		}
 
-		entry->device = handle;
-		entry->type = type;
-		list_add_tail(&entry->node, &priv->notify);
+		up(&priv->subs_sem);
+
+		return (found || !filter.id) ? 0 : -ENOENT;
+
+	} else if (cmd == DEV_ACPI_SAMPLER_ADD) {
+
+		dev_acpi_sampler_t	data;
+		int			ret;
+
+		if (copy_from_user(&data, (dev_acpi_sampler_t *)arg,
+		                   sizeof(data)))
+			return -EFAULT;
+
+		ret = dev_acpi_sampler_add(f, &data);
 
+		if (ret)
+			return ret;
+
+		if (copy_to_user((dev_acpi_sampler_t *)arg, &data,
+		                 sizeof(data))) {
+			dev_acpi_sampler_remove(f, data.sample);
+			return -EFAULT;
+		}
 		return 0;
 
-	} else if (cmd == DEV_ACPI_REMOVE_DEVICE_NOTIFY ||
-	           cmd == DEV_ACPI_REMOVE_SYSTEM_NOTIFY) {
+	} else if (cmd == DEV_ACPI_SAMPLER_REMOVE) {
 
-		dev_acpi_t		data;
-		acpi_handle		handle;
-		acpi_status		status;
-		struct notify_list	*entry;
-		struct list_head	*node;
-		u32			type;
+		dev_acpi_sampler_t	data;
+
+		if (copy_from_user(&data, (dev_acpi_sampler_t *)arg,
+		                   sizeof(data)))
+			return -EFAULT;
+
+		return dev_acpi_sampler_remove(f, data.sample);
+
+	} else if (cmd == DEV_ACPI_SAMPLER_READ) {
+
+		dev_acpi_t	data;
+		int		ret;
 
 		dev_acpi_clear(f, READ_CLEAR | WRITE_CLEAR);
 
 		if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
 			return -EFAULT;
 
-		handle = dev_acpi_get_handle(data.pathname);
+		ret = dev_acpi_sampler_read(f);
 
-		if (!handle)
-			return -ENOENT;
+		if (ret)
+			return ret;
+
+		data.return_size = RBUF(f)->length;
+
+		if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data))) {
+			dev_acpi_clear(f, READ_CLEAR);
+			return -EFAULT;
+		}
 
-		type = (cmd == DEV_ACPI_REMOVE_SYSTEM_NOTIFY) ?
-		       ACPI_SYSTEM_NOTIFY : ACPI_DEVICE_NOTIFY;
+		if (data.return_size)
+			dev_acpi_ready(f);
+		return 0;
 
-		status = acpi_remove_notify_handler(handle, type,
-		                                    dev_acpi_notify);
+	} else if (cmd == DEV_ACPI_GET_STATS) {
 
-		if (ACPI_FAILURE(status))
-			return -EIO;
+		dev_acpi_stats_t	stats;
 
-		list_for_each(node, &priv->notify) {
-			entry = list_entry(node, struct notify_list, node);
+		memset(&stats, 0, sizeof(stats));
+		stats.generation = atomic_read(&ns_generation);
 
-			if (entry->device == handle && entry->type == type) {
-				list_del(&entry->node);
-				kfree(entry);
-				break;
-			}
-		}
+		down(&name_index_sem);
+		stats.name_index_rebuilds = name_index_rebuilds;
+		stats.name_index_entries = name_index ? name_index_count : 0;
+		up(&name_index_sem);
+
+		down(&hid_index_sem);
+		stats.hid_index_rebuilds = hid_index_rebuilds;
+		up(&hid_index_sem);
+
+		spin_lock(&eval_cache_lock);
+		stats.eval_cache_hits = eval_cache_hits;
+		stats.eval_cache_misses = eval_cache_misses;
+		stats.eval_cache_coalesced = eval_cache_coalesced;
+		stats.eval_cache_entries = eval_cache_count;
+		spin_unlock(&eval_cache_lock);
+
+		if (copy_to_user((dev_acpi_stats_t *)arg, &stats,
+		                 sizeof(stats)))
+			return -EFAULT;
+		return 0;
+
+	} else if (cmd == DEV_ACPI_FLUSH_CACHES) {
+
+		dev_acpi_ns_changed();
+		return 0;
+
+	} else if (cmd == DEV_ACPI_SET_CLASS) {
+
+		dev_acpi_class_t	data;
+
+		if (copy_from_user(&data, (dev_acpi_class_t *)arg,
+		                   sizeof(data)))
+			return -EFAULT;
+
+		if (data.eval_class >= DEV_ACPI_CLASSES)
+			return -EINVAL;
+
+		/* jumping the queue is a privilege, like nice */
+		if (data.eval_class < DEV_ACPI_CLASS_NORMAL &&
+		    !capable(CAP_SYS_NICE))
+			return -EPERM;
+
+		priv->eval_class = data.eval_class;
+		return 0;
+
+	} else if (cmd == DEV_ACPI_GET_SCHED_STATS) {
+
+		dev_acpi_sched_stats_t	stats;
+		int			j;
+
+		spin_lock(&eval_sched_lock);
+		for (j = 0 ; j < DEV_ACPI_CLASSES ; j++)
+			stats.classes[j] = eval_classes[j].stats;
+		spin_unlock(&eval_sched_lock);
+
+		if (copy_to_user((dev_acpi_sched_stats_t *)arg, &stats,
+		                 sizeof(stats)))
+			return -EFAULT;
+		return 0;
+
+	} else if (cmd == DEV_ACPI_PER_THREAD) {
+
+		void	*read, *write;
+
+		/* the shared buffers aren't used from now on */
+		spin_lock(&priv->lock);
+		priv->per_thread = 1;
+		priv->shared.ready = 0;
+		read = priv->shared.read.pointer;
+		write = priv->shared.write.pointer;
+		memset(&priv->shared.read, 0, sizeof(priv->shared.read));
+		memset(&priv->shared.write, 0, sizeof(priv->shared.write));
+		spin_unlock(&priv->lock);
+
+		kfree(read);
+		kfree(write);
 		return 0;
 
 	} else if (cmd == DEV_ACPI_BUS_GENERATE_EVENT) {
@@ -1197,11 +5439,72 @@ dev_acpi_ioctl(
 	return -EINVAL;
 }
 
+/*
+ * Everything runs on the calling thread's buffers, see dev_acpi_ctx().
+ * Nothing here relies on the BKL, module wide state has its own locks
+ * and per open state is locked by the open.
+ */
+static int
+dev_acpi_file_ioctl(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	struct file_ctx	*ctx;
+	int		ret;
+
+	ctx = dev_acpi_ctx_get(f);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	dev_acpi_ctx_put(f, ctx);
+	return ret;
+}
+
+#ifdef HAVE_UNLOCKED_IOCTL
+static long
+dev_acpi_unlocked_ioctl(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	return dev_acpi_file_ioctl(f, cmd, arg);
+}
+#else
+static int
+dev_acpi_ioctl(
+	struct inode	*i,
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	return dev_acpi_file_ioctl(f, cmd, arg);
+}
+#endif
+
+#ifdef HAVE_COMPAT_IOCTL
+static long dev_acpi_compat_ioctl(struct file *, unsigned int,
+                                  unsigned long);
+#endif
+
 static struct file_operations dev_acpi_fops = {
 	.owner		= THIS_MODULE,
 	.read		= dev_acpi_read,
 	.write		= dev_acpi_write,
+	.poll		= dev_acpi_poll,
+#ifdef HAVE_UNLOCKED_IOCTL
+	.unlocked_ioctl	= dev_acpi_unlocked_ioctl,
+#else
 	.ioctl		= dev_acpi_ioctl,
+#endif
+#ifdef HAVE_COMPAT_IOCTL
+	.compat_ioctl	= dev_acpi_compat_ioctl,
+#endif
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,0)
+	.mmap		= dev_acpi_mmap,
+#endif
 	.open		= dev_acpi_open,
 	.release	= dev_acpi_release,
 };
@@ -1684,47 +5987,35 @@ convert_element(
 }
 
 static int
-fix_return32(unsigned long arg, acpi_size length)
+fix_return32(u32 *return_size, acpi_size length)
 {
-	dev_acpi_t	data;
-
-	if (copy_from_user(&data, (dev_acpi_t *)arg, sizeof(data)))
-		return 0;
-
-	data.return_size = length;
+	u32 size = length;
 
-	if (copy_to_user((dev_acpi_t *)arg, &data, sizeof(data)))
-		return 0;
-
-	return 1;
+	return !copy_to_user(return_size, &size, sizeof(size));
 }
 
+/*
+ * Replace the native acpi_object in the read buffer with its ILP32 layout
+ * and update return_size in the caller's argument to match.
+ */
 static int
-ioctl32_get_type(
-	unsigned int	fd,
-	unsigned int	cmd,
-	unsigned long	arg,
-	struct file	*f)
+ioctl32_convert_result(
+	struct file	*f,
+	u32		*return_size)
 {
-	int			ret;
 	struct acpi_buffer	*buffer, *rbuf;
 
-	ret = sys_ioctl(fd, cmd, arg);
-
-	if (ret < 0)
-		return ret;
-
 	rbuf = RBUF(f);
-	dump_buffer("ioctl32_get_type: pre", rbuf);
+	dump_buffer("ioctl32_convert_result: pre", rbuf);
 	buffer = convert_element((union acpi_object *)rbuf->pointer);
-	dump_buffer("ioctl32_get_type: post", buffer);
+	dump_buffer("ioctl32_convert_result: post", buffer);
 
 	dev_acpi_clear(f, READ_CLEAR);
 
 	if (!buffer)
 		return -EPIPE;
 
-	if (!fix_return32(arg, buffer->length)) {
+	if (!fix_return32(return_size, buffer->length)) {
 		if (buffer->pointer)
 			kfree(buffer->pointer);
 		kfree(buffer);
@@ -1733,29 +6024,25 @@ ioctl32_get_type(
 
 	rbuf->pointer = buffer->pointer;
 	rbuf->length = buffer->length;
-
 	kfree(buffer);
 
-	return ret;
+	dev_acpi_ready(f);
+	return 0;
 }
 
+/* Convert an ILP32 argument list in the write buffer to the native layout */
 static int
-ioctl32_evaluate_object(
-	unsigned int	fd,
-	unsigned int	cmd,
-	unsigned long	arg,
-	struct file	*f)
+ioctl32_convert_args(struct file *f)
 {
-	struct acpi_buffer	*buffer, *wbuf, *rbuf;
-	int			ret;
+	struct acpi_buffer	*buffer, *wbuf;
 
 	wbuf = WBUF(f);
 	if (wbuf->pointer && wbuf->length >=
 	    sizeof(struct acpi_object_list32) + sizeof(union acpi_object32)) {
 
-		dump_buffer("ioctl32_evaluate_object: pre", wbuf);
+		dump_buffer("ioctl32_convert_args: pre", wbuf);
 		buffer = convert_arglist32(wbuf->pointer);
-		dump_buffer("ioctl32_evaluate_object: post", buffer);
+		dump_buffer("ioctl32_convert_args: post", buffer);
 
 		if (!buffer)
 			return -EINVAL;
@@ -1765,55 +6052,443 @@ ioctl32_evaluate_object(
 		wbuf->length = buffer->length;
 		kfree(buffer);
 	}
-		
-	ret = sys_ioctl(fd, cmd, arg);
+	return 0;
+}
+
+/* Same as above, for a result left in the mmap'd area */
+static int
+ioctl32_convert_area(
+	struct file	*f,
+	u32		*return_size)
+{
+	priv_data_t		*priv = (priv_data_t *)f->private_data;
+	struct acpi_buffer	*buffer;
+	u32			size;
+
+	if (get_user(size, return_size))
+		return -EFAULT;
+
+	if (!size)
+		return 0;
+
+	buffer = convert_element((union acpi_object *)priv->area);
+
+	if (!buffer)
+		return -EPIPE;
+
+	if (buffer->length > priv->area_size) {
+		kfree(buffer->pointer);
+		kfree(buffer);
+		return -E2BIG;
+	}
+
+	memcpy(priv->area, buffer->pointer, buffer->length);
+	kfree(buffer->pointer);
+
+	if (!fix_return32(return_size, buffer->length)) {
+		kfree(buffer);
+		return -EPIPE;
+	}
+
+	kfree(buffer);
+	return 0;
+}
+
+static int
+ioctl32_get_type(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	int ret;
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	if (ret < 0)
+		return ret;
+
+	return ioctl32_convert_result(f, &((dev_acpi_t *)arg)->return_size);
+}
+
+static int
+ioctl32_evaluate_object(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	int ret;
+
+	ret = ioctl32_convert_args(f);
+	if (ret)
+		return ret;
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	if (ret < 0)
+		return ret;
+
+	if (RBUF(f)->pointer && RBUF(f)->length)
+		return ioctl32_convert_result(f,
+		                        &((dev_acpi_t *)arg)->return_size);
+	return ret;
+}
+
+static int
+ioctl32_evaluate_mmap(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	int ret;
+
+	ret = ioctl32_convert_args(f);
+	if (ret)
+		return ret;
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	if (ret < 0)
+		return ret;
+
+	return ioctl32_convert_area(f, &((dev_acpi_t *)arg)->return_size);
+}
+
+/* Rebuild the batch results with any acpi_objects in the ILP32 layout */
+static int
+ioctl32_batch(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	struct acpi_buffer	*rbuf, *buffer;
+	dev_acpi_batch_result_t	*res;
+	result_buf_t		rb = {NULL, 0, 0};
+	u32			i, count, offset;
+	int			ret;
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
 
 	if (ret < 0)
 		return ret;
 
 	rbuf = RBUF(f);
-	if (rbuf->pointer && rbuf->length) {
-		dump_buffer("ioctl32_evaluate_object: pre", rbuf);
-		buffer = convert_element((union acpi_object *)rbuf->pointer);
-		dump_buffer("ioctl32_evaluate_object: post", buffer);
+	res = rbuf->pointer;
+	count = rbuf->length / sizeof(*res);
+
+	if (!count)
+		return ret;
+
+	for (i = 0 ; i < count ; i++)
+		if (res[i].length && (res[i].cmd == DEV_ACPI_GET_TYPE ||
+		                      res[i].cmd == DEV_ACPI_EVALUATE_OBJ))
+			break;
+
+	/* nothing to convert */
+	if (i == count)
+		return ret;
+
+	if (!result_buf_append(&rb, res, count * sizeof(*res)))
+		goto nomem;
+
+	for (i = 0 ; i < count ; i++) {
+		void	*data = (char *)rbuf->pointer + res[i].offset;
+		size_t	length = res[i].length;
+
+		if (!length)
+			continue;
+
+		buffer = NULL;
+		if (res[i].cmd == DEV_ACPI_GET_TYPE ||
+		    res[i].cmd == DEV_ACPI_EVALUATE_OBJ) {
+			buffer = convert_element((union acpi_object *)data);
+			if (!buffer)
+				goto nomem;
 
+			data = buffer->pointer;
+			length = buffer->length;
+		}
+
+		offset = (rb.length + 7) & ~7;
+
+		if (!result_buf_reserve(&rb, offset - rb.length + length)) {
+			if (buffer) {
+				kfree(buffer->pointer);
+				kfree(buffer);
+			}
+			goto nomem;
+		}
+
+		memset(rb.pointer + rb.length, 0, offset - rb.length);
+		memcpy(rb.pointer + offset, data, length);
+		rb.length = offset + length;
+
+		((dev_acpi_batch_result_t *)rb.pointer)[i].offset = offset;
+		((dev_acpi_batch_result_t *)rb.pointer)[i].length = length;
+
+		if (buffer) {
+			kfree(buffer->pointer);
+			kfree(buffer);
+		}
+	}
+
+	dev_acpi_clear(f, READ_CLEAR);
+	rbuf->pointer = rb.pointer;
+	rbuf->length = rb.length;
+
+	if (!fix_return32(&((dev_acpi_batch_t *)arg)->return_size,
+	                  rbuf->length)) {
 		dev_acpi_clear(f, READ_CLEAR);
+		return -EPIPE;
+	}
+
+	dev_acpi_ready(f);
+	return ret;
+ nomem:
+	result_buf_free(&rb);
+	dev_acpi_clear(f, READ_CLEAR);
+	return -ENOMEM;
+}
+
+static int
+ioctl32_by_id(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	dev_acpi_id_t	*data = (dev_acpi_id_t *)arg;
+	u32		id_cmd;
+	int		ret;
+
+	if (get_user(id_cmd, &data->cmd))
+		return -EFAULT;
+
+	if (id_cmd == DEV_ACPI_EVALUATE_OBJ ||
+	    id_cmd == DEV_ACPI_EVALUATE_MMAP) {
+		ret = ioctl32_convert_args(f);
+		if (ret)
+			return ret;
+	}
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	if (ret < 0)
+		return ret;
+
+	if (id_cmd == DEV_ACPI_EVALUATE_MMAP)
+		return ioctl32_convert_area(f, &data->return_size);
+
+	if (id_cmd == DEV_ACPI_GET_TYPE ||
+	    (id_cmd == DEV_ACPI_EVALUATE_OBJ && RBUF(f)->pointer &&
+	     RBUF(f)->length))
+		return ioctl32_convert_result(f, &data->return_size);
+
+	return ret;
+}
+
+/* ASYNC_REAP completions, results converted the same way as a batch */
+static int
+ioctl32_async_reap(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	struct acpi_buffer	*rbuf, *buffer;
+	dev_acpi_completion_t	*comp;
+	result_buf_t		rb = {NULL, 0, 0};
+	u32			i, count, offset;
+	int			ret;
+
+	ret = dev_acpi_do_ioctl(f, cmd, arg);
+
+	if (ret < 0)
+		return ret;
+
+	if (get_user(count, &((dev_acpi_async_t *)arg)->count))
+		return -EFAULT;
+
+	if (!count)
+		return ret;
+
+	rbuf = RBUF(f);
+	comp = rbuf->pointer;
+
+	if (!result_buf_append(&rb, comp, count * sizeof(*comp)))
+		goto nomem;
 
+	for (i = 0 ; i < count ; i++) {
+		if (!comp[i].length)
+			continue;
+
+		buffer = convert_element((union acpi_object *)
+		                         ((char *)rbuf->pointer +
+		                          comp[i].offset));
 		if (!buffer)
-			return -EPIPE;
+			goto nomem;
 
-		if (!fix_return32(arg, buffer->length)) {
+		offset = (rb.length + 7) & ~7;
+
+		if (!result_buf_reserve(&rb, offset - rb.length +
+		                             buffer->length)) {
 			kfree(buffer->pointer);
 			kfree(buffer);
-			return -EPIPE;
+			goto nomem;
 		}
 
-		rbuf->pointer = buffer->pointer;
-		rbuf->length = buffer->length;
+		memset(rb.pointer + rb.length, 0, offset - rb.length);
+		memcpy(rb.pointer + offset, buffer->pointer, buffer->length);
+		rb.length = offset + buffer->length;
+
+		((dev_acpi_completion_t *)rb.pointer)[i].offset = offset;
+		((dev_acpi_completion_t *)rb.pointer)[i].length =
+		                                              buffer->length;
+		kfree(buffer->pointer);
+		kfree(buffer);
+	}
+
+	dev_acpi_clear(f, READ_CLEAR);
+	rbuf->pointer = rb.pointer;
+	rbuf->length = rb.length;
+
+	if (!fix_return32(&((dev_acpi_async_t *)arg)->return_size,
+	                  rbuf->length)) {
+		dev_acpi_clear(f, READ_CLEAR);
+		return -EPIPE;
+	}
+
+	dev_acpi_ready(f);
+	return ret;
+ nomem:
+	/* the completions are gone, the caller only gets the error */
+	result_buf_free(&rb);
+	dev_acpi_clear(f, READ_CLEAR);
+	return -ENOMEM;
+}
+
+/*
+ * 32bit callers.  Most structures have the same layout either way, the
+ * ioctls that pass acpi_objects get them converted.  Holds the caller's
+ * context across the native ioctl and the conversion.
+ */
+static int
+dev_acpi_ioctl32(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	struct file_ctx	*ctx;
+	int		ret;
+
+	ctx = dev_acpi_ctx_get(f);
+	if (IS_ERR(ctx))
+		return PTR_ERR(ctx);
+
+	switch (cmd) {
+	case DEV_ACPI_GET_TYPE:
+		ret = ioctl32_get_type(f, cmd, arg);
+		break;
+	case DEV_ACPI_EVALUATE_OBJ:
+		ret = ioctl32_evaluate_object(f, cmd, arg);
+		break;
+	case DEV_ACPI_EVALUATE_MMAP:
+		ret = ioctl32_evaluate_mmap(f, cmd, arg);
+		break;
+	case DEV_ACPI_BATCH:
+		ret = ioctl32_batch(f, cmd, arg);
+		break;
+	case DEV_ACPI_BY_ID:
+		ret = ioctl32_by_id(f, cmd, arg);
+		break;
+	case DEV_ACPI_ASYNC_REAP:
+		ret = ioctl32_async_reap(f, cmd, arg);
+		break;
+	default:
+		ret = dev_acpi_do_ioctl(f, cmd, arg);
+		break;
 	}
+
+	dev_acpi_ctx_put(f, ctx);
 	return ret;
 }
 
+#ifdef HAVE_COMPAT_IOCTL
+static long
+dev_acpi_compat_ioctl(
+	struct file	*f,
+	unsigned int	cmd,
+	unsigned long	arg)
+{
+	return dev_acpi_ioctl32(f, cmd, (unsigned long)compat_ptr(arg));
+}
+
+#define dev_acpi_register_ioctl32()
+#define dev_acpi_unregister_ioctl32()
+#else
+/*
+ * Without compat_ioctl, conversions are registered by command number,
+ * which other drivers may use too.
+ */
+static unsigned int dev_acpi_ioctl32_cmds[] = {
+	DEV_ACPI_CLEAR,
+	DEV_ACPI_DEVICE_NOTIFY,
+	DEV_ACPI_EVENT_CONFIG,
+	DEV_ACPI_FLUSH_CACHES,
+	DEV_ACPI_EVAL_FAST,
+	DEV_ACPI_EVALUATE_OBJ,
+	DEV_ACPI_EVALUATE_MMAP,
+	DEV_ACPI_EXISTS,
+	DEV_ACPI_BATCH,
+	DEV_ACPI_BUS_GENERATE_EVENT,
+	DEV_ACPI_BY_ID,
+	DEV_ACPI_CLOSE_HANDLE,
+	DEV_ACPI_GET_DEVICES,
+	DEV_ACPI_GET_DEVICES_EXT,
+	DEV_ACPI_GET_DEVICE_INFO,
+	DEV_ACPI_GET_NEXT,
+	DEV_ACPI_GET_NEXT_NODES,
+	DEV_ACPI_GET_NOTIFIERS,
+	DEV_ACPI_GET_OBJECTS,
+	DEV_ACPI_GET_PARENT,
+	DEV_ACPI_GET_STATS,
+	DEV_ACPI_GET_SUBTREE,
+	DEV_ACPI_GET_TYPE,
+	DEV_ACPI_NOTIFY_FILTER,
+	DEV_ACPI_NOTIFY_SUBTREE,
+	DEV_ACPI_OPEN_HANDLE,
+	DEV_ACPI_REMOVE_DEVICE_NOTIFY,
+	DEV_ACPI_REMOVE_SYSTEM_NOTIFY,
+	DEV_ACPI_SAMPLER_ADD,
+	DEV_ACPI_SAMPLER_READ,
+	DEV_ACPI_ASYNC_SUBMIT,
+	DEV_ACPI_ASYNC_REAP,
+	DEV_ACPI_PER_THREAD,
+	DEV_ACPI_SET_CLASS,
+	DEV_ACPI_GET_SCHED_STATS,
+	DEV_ACPI_SAMPLER_REMOVE,
+	DEV_ACPI_SYS_INFO,
+	DEV_ACPI_SYSTEM_NOTIFY,
+};
+
+static int
+ioctl32_handler(
+	unsigned int	fd,
+	unsigned int	cmd,
+	unsigned long	arg,
+	struct file	*f)
+{
+	if (f->f_op != &dev_acpi_fops)
+		return sys_ioctl(fd, cmd, arg);
+
+	return dev_acpi_ioctl32(f, cmd, arg);
+}
+
 static void __init
 dev_acpi_register_ioctl32(void)
 {
-	int err;
-
-	err = register_ioctl32_conversion(DEV_ACPI_CLEAR, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_DEVICE_NOTIFY, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_EVALUATE_OBJ,
-	                                   ioctl32_evaluate_object);
-	err |= register_ioctl32_conversion(DEV_ACPI_EXISTS, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_BUS_GENERATE_EVENT, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_GET_DEVICES, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_GET_NEXT, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_GET_OBJECTS, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_GET_PARENT, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_GET_TYPE, ioctl32_get_type);
-	err |= register_ioctl32_conversion(DEV_ACPI_REMOVE_DEVICE_NOTIFY, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_REMOVE_SYSTEM_NOTIFY, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_SYS_INFO, NULL);
-	err |= register_ioctl32_conversion(DEV_ACPI_SYSTEM_NOTIFY, NULL);
+	int	i, err = 0;
+
+	for (i = 0 ; i < ARRAY_SIZE(dev_acpi_ioctl32_cmds) ; i++)
+		err |= register_ioctl32_conversion(dev_acpi_ioctl32_cmds[i],
+		                                   ioctl32_handler);
 
 	if (err)
 		printk(KERN_WARNING "%s: error registering ioctl32 "\
@@ -1823,27 +6498,16 @@ dev_acpi_register_ioctl32(void)
 static void __exit
 dev_acpi_unregister_ioctl32(void)
 {
-	int err;
-
-	err = unregister_ioctl32_conversion(DEV_ACPI_CLEAR);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_DEVICE_NOTIFY);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_EVALUATE_OBJ);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_EXISTS);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_BUS_GENERATE_EVENT);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_GET_DEVICES);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_GET_NEXT);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_GET_OBJECTS);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_GET_PARENT);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_GET_TYPE);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_REMOVE_DEVICE_NOTIFY);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_REMOVE_SYSTEM_NOTIFY);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_SYS_INFO);
-	err |= unregister_ioctl32_conversion(DEV_ACPI_SYSTEM_NOTIFY);
+	int	i, err = 0;
+
+	for (i = 0 ; i < ARRAY_SIZE(dev_acpi_ioctl32_cmds) ; i++)
+		err |= unregister_ioctl32_conversion(dev_acpi_ioctl32_cmds[i]);
 
 	if (err)
 		printk(KERN_WARNING "%s: error unregistering ioctl32 "\
 		                    "conversions\n", DEV_ACPI_NAME);
 }
+#endif /* HAVE_COMPAT_IOCTL */
 #else
 #define dev_acpi_register_ioctl32()
 #define dev_acpi_unregister_ioctl32()
@@ -1852,6 +6516,19 @@ dev_acpi_unregister_ioctl32(void)
 static int __init
 dev_acpi_init(void)
 {
+	int i;
+
+	for (i = 0 ; i < HID_INDEX_BUCKETS ; i++)
+		INIT_LIST_HEAD(&hid_index[i]);
+
+	for (i = 0 ; i < NOTIFY_SOURCE_BUCKETS ; i++)
+		INIT_LIST_HEAD(&notify_sources[i]);
+
+	eval_cache_init();
+
+	for (i = 0 ; i < DEV_ACPI_CLASSES ; i++)
+		INIT_LIST_HEAD(&eval_classes[i].queue);
+
 	major = register_chrdev(0, DEV_ACPI_DEVICE_NAME, &dev_acpi_fops);
 
 	if (major < 0) {
@@ -1872,6 +6549,14 @@ dev_acpi_init(void)
 	CLASS_DEVICE_CREATE(dev_acpi_class, MKDEV(major, 0), NULL, "acpi");
 #endif
 
+#ifdef ACPI_TABLE_EVENT_LOAD
+	if (ACPI_FAILURE(acpi_install_table_handler(dev_acpi_table_event,
+	                                            NULL)))
+		printk(KERN_WARNING "%s: unable to install table handler, "
+		       "namespace lookups won't be cached\n", DEV_ACPI_NAME);
+	else
+		ns_tracked = 1;
+#endif
 	dev_acpi_register_ioctl32();
 	return 0; 
 }
@@ -1885,6 +6570,14 @@ dev_acpi_exit(void)
 	CLASS_DESTROY(dev_acpi_class);
 #endif
 	dev_acpi_unregister_ioctl32();
+#ifdef ACPI_TABLE_EVENT_LOAD
+	if (ns_tracked)
+		acpi_remove_table_handler(dev_acpi_table_event);
+#endif
+	vfree(name_index);
+	hid_index_free();
+	eval_cache_exit();
+	notify_source_free_all();
 	return;
 }
 
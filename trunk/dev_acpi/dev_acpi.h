@@ -12,6 +12,308 @@ typedef struct {
 	u32		return_size;
 } dev_acpi_t;
 
+/*
+ * Child object record returned by DEV_ACPI_GET_NEXT_NODES.  Fixed size,
+ * no pointers, so the layout is the same for 32bit and 64bit callers.
+ */
+typedef struct {
+	char		name[4];	/* NameSeg, not terminated */
+	u32		type;		/* acpi_object_type */
+	u32		children;	/* number of objects below this one */
+} dev_acpi_node_t;
+
+/*
+ * Record returned by DEV_ACPI_GET_SUBTREE, one per object in preorder.
+ * The first record is the root of the walk.
+ */
+typedef struct {
+	char		name[4];	/* NameSeg, not terminated */
+	u32		type;		/* acpi_object_type */
+	u32		depth;		/* 0 = root of the walk */
+	u32		parent;		/* index of parent record */
+} dev_acpi_subtree_node_t;
+
+#define DEV_ACPI_NO_PARENT	0xffffffff
+
+/*
+ * Per open event queue configuration and counters, see
+ * DEV_ACPI_EVENT_CONFIG
+ */
+#define DEV_ACPI_EVENT_BINARY	0x1	/* read dev_acpi_event_t records */
+#define DEV_ACPI_EVENT_TEXT	0x2	/* read "%s,%08x\n" lines */
+
+typedef struct {
+	u32		depth;		/* ring depth, 0 = leave unchanged */
+	u32		queued;		/* events waiting to be read */
+	u32		overflows;	/* events dropped, ring was full */
+	u32		flags;		/* DEV_ACPI_EVENT_*, 0 = unchanged */
+} dev_acpi_event_config_t;
+
+/*
+ * Event as read in binary mode.  id is the subscription it arrived on,
+ * see DEV_ACPI_GET_NOTIFIERS.
+ */
+typedef struct {
+	u32		id;		/* subscription or sampler ID */
+	u32		event;		/* notify value */
+	u64		timestamp;	/* ns, monotonic clock, first event */
+	u32		count;		/* events coalesced into this one */
+	u32		reserved;
+	u64		old_value;	/* DEV_ACPI_EVENT_VALUE_CHANGE only */
+	u64		new_value;
+} dev_acpi_event_t;
+
+/* event of a DEV_ACPI_SAMPLER_CHANGES sampler, id is the sampler ID */
+#define DEV_ACPI_EVENT_VALUE_CHANGE	0x100
+
+/* Bitmap of notify values 0-255 to deliver, see DEV_ACPI_NOTIFY_FILTER */
+#define DEV_ACPI_EVENT_MASK_WORDS	8
+
+/* Subscription record returned by DEV_ACPI_GET_NOTIFIERS */
+typedef struct {
+	u32		id;		/* as in dev_acpi_event_t */
+	u32		type;		/* ACPI_DEVICE_NOTIFY/ACPI_SYSTEM_NOTIFY */
+	char		pathname[ACPI_PATHNAME_MAX];
+	u32		mask[DEV_ACPI_EVENT_MASK_WORDS];
+	u32		window_ms;	/* coalescing window */
+	u32		reserved;
+	u64		delivered;	/* events queued */
+	u64		filtered;	/* dropped by the mask */
+	u64		coalesced;	/* folded into a queued event */
+	u64		overflows;	/* dropped, queue was full */
+} dev_acpi_notifier_t;
+
+/*
+ * Event filter for a subscription, see DEV_ACPI_NOTIFY_FILTER.  Bit n of
+ * mask passes notify value n.  Repeats of the last queued event within
+ * window_ms are counted in it instead of queued.
+ */
+typedef struct {
+	u32		id;		/* subscription ID, 0 = all */
+	u32		window_ms;	/* 0 = no coalescing */
+	u32		mask[DEV_ACPI_EVENT_MASK_WORDS];
+} dev_acpi_notify_filter_t;
+
+/*
+ * Module wide counters, see DEV_ACPI_GET_STATS.  All fields are u64 so
+ * the layout is the same for 32bit and 64bit callers.
+ */
+typedef struct {
+	u64		generation;	/* namespace generation */
+	u64		handle_cache_hits;	/* unused, always 0 */
+	u64		handle_cache_misses;	/* unused, always 0 */
+	u64		name_index_rebuilds;	/* DEV_ACPI_GET_OBJECTS index */
+	u64		name_index_entries;
+	u64		hid_index_rebuilds;	/* DEV_ACPI_GET_DEVICES index */
+	u64		eval_cache_hits;	/* eval_cache module param */
+	u64		eval_cache_misses;
+	u64		eval_cache_coalesced;	/* waited for an evaluation */
+	u64		eval_cache_entries;
+} dev_acpi_stats_t;
+
+/*
+ * Request on an object opened with DEV_ACPI_OPEN_HANDLE, see DEV_ACPI_BY_ID.
+ * cmd is one of the path based ioctls that operate on a single object.
+ */
+typedef struct {
+	u32		cmd;		/* eg. DEV_ACPI_EVALUATE_OBJ */
+	u32		id;		/* from DEV_ACPI_OPEN_HANDLE */
+	char		name[16];	/* optional path relative to id */
+	u32		return_size;
+	u32		reserved;
+} dev_acpi_id_t;
+
+/*
+ * Evaluate with integer arguments and a small result passed inline, see
+ * DEV_ACPI_EVAL_FAST.  Every field is naturally aligned and the size is
+ * a multiple of 8, so the layout is the same for 32bit and 64bit callers.
+ */
+#define DEV_ACPI_FAST_ARGS	4
+#define DEV_ACPI_FAST_DATA	64
+
+typedef struct {
+	char		pathname[ACPI_PATHNAME_MAX];	/* relative if id set */
+	u32		id;		/* handle ID, 0 = use pathname */
+	u32		arg_count;
+	u64		args[DEV_ACPI_FAST_ARGS];	/* integer arguments */
+	u32		type;		/* result type, 0 if none */
+	u32		length;		/* string/buffer result length */
+	u64		value;		/* integer result */
+	u8		data[DEV_ACPI_FAST_DATA];	/* string/buffer result */
+} dev_acpi_eval_fast_t;
+
+/*
+ * DEV_ACPI_BATCH operations, written as an array to the device file.
+ * cmd is one of the ioctls allowed with DEV_ACPI_BY_ID except
+ * DEV_ACPI_EVALUATE_MMAP.  Evaluations take integer arguments inline.
+ */
+typedef struct {
+	u32		cmd;		/* eg. DEV_ACPI_GET_TYPE */
+	u32		id;		/* handle ID, 0 = use pathname */
+	char		pathname[ACPI_PATHNAME_MAX];	/* relative if id set */
+	u32		arg_count;
+	u32		reserved;
+	u64		args[DEV_ACPI_FAST_ARGS];	/* integer arguments */
+} dev_acpi_batch_op_t;
+
+/*
+ * DEV_ACPI_BATCH results, an array with one entry per operation at the
+ * start of the read buffer.  Result data follows, each one laid out as
+ * for the single ioctl with offsets relative to its own start.
+ */
+typedef struct {
+	u32		status;		/* 0 or errno value */
+	u32		cmd;		/* copied from the operation */
+	u32		offset;		/* of data from start of read buffer */
+	u32		length;		/* of data, 0 if none */
+} dev_acpi_batch_result_t;
+
+typedef struct {
+	u32		count;		/* number of operations */
+	u32		return_size;
+} dev_acpi_batch_t;
+
+/*
+ * Device identification returned by DEV_ACPI_GET_DEVICE_INFO.  valid has
+ * the ACPI_VALID_* bits of the fields ACPI CA filled in.  IDs are
+ * terminated strings, at most DEV_ACPI_INFO_CIDS _CIDs are stored.
+ */
+#define DEV_ACPI_INFO_CIDS	8
+#define DEV_ACPI_INFO_ID_LEN	48
+
+typedef struct {
+	char		name[4];	/* NameSeg, not terminated */
+	u32		type;		/* acpi_object_type */
+	u32		valid;		/* ACPI_VALID_* */
+	u32		sta;		/* _STA */
+	u64		adr;		/* _ADR */
+	char		hid[16];	/* _HID */
+	char		uid[DEV_ACPI_INFO_ID_LEN];	/* _UID */
+	u32		cid_count;	/* _CIDs found, may exceed the max */
+	u32		reserved;
+	char		cid[DEV_ACPI_INFO_CIDS][DEV_ACPI_INFO_ID_LEN];
+} dev_acpi_device_info_t;
+
+/*
+ * Install or remove notify handlers on every object below a path, see
+ * DEV_ACPI_NOTIFY_SUBTREE.  type 0 means Device, Processor, ThermalZone
+ * and PowerResource objects.
+ */
+#define DEV_ACPI_NOTIFY_DEVICE	0x1	/* device notify handlers */
+#define DEV_ACPI_NOTIFY_SYSTEM	0x2	/* system notify handlers */
+#define DEV_ACPI_NOTIFY_REMOVE	0x4	/* remove instead of install */
+
+typedef struct {
+	char		pathname[ACPI_PATHNAME_MAX];
+	u32		flags;		/* DEV_ACPI_NOTIFY_* */
+	u32		type;		/* acpi_object_type to act on */
+	u32		count;		/* objects walked, bits in the bitmap */
+	u32		matched;	/* objects of the requested type */
+	u32		done;		/* handlers installed or removed */
+	u32		exists;		/* installs failed with EEXIST */
+	u32		failed;		/* other failures */
+	u32		return_size;	/* length of the bitmap */
+} dev_acpi_notify_subtree_t;
+
+/*
+ * Register an object to be evaluated periodically, see
+ * DEV_ACPI_SAMPLER_ADD.
+ */
+#define DEV_ACPI_SAMPLER_CHANGES	0x1	/* events on change, no ring */
+
+typedef struct {
+	char		pathname[ACPI_PATHNAME_MAX];	/* relative if id set */
+	u32		id;		/* handle ID, 0 = use pathname */
+	u32		interval_ms;
+	u32		sample;		/* sampler ID, returned by ADD */
+	u32		flags;		/* DEV_ACPI_SAMPLER_* */
+} dev_acpi_sampler_t;
+
+/*
+ * Sampler result.  Integer results give one record, packages one per
+ * integer element with index set.  status is 0 or an errno value.
+ */
+typedef struct {
+	u32		sample;		/* sampler ID */
+	u32		status;
+	u64		timestamp;	/* ns, monotonic clock */
+	u32		index;		/* package element */
+	u32		reserved;
+	u64		value;
+} dev_acpi_sample_t;
+
+/*
+ * Sample ring as mmap'd at DEV_ACPI_SAMPLER_MMAP, slots records follow
+ * the header.  Record n is at (n % slots).  The module advances head,
+ * the reader advances tail once it's done with the records.
+ */
+#define DEV_ACPI_SAMPLER_MMAP	0x10000000	/* mmap offset */
+
+typedef struct {
+	u32		slots;
+	u32		head;		/* free running, written by module */
+	u32		tail;		/* free running, written by reader */
+	u32		overflows;	/* records dropped, ring was full */
+	u32		reserved[4];
+} dev_acpi_sampler_ring_t;
+
+/*
+ * Evaluation queued with DEV_ACPI_ASYNC_SUBMIT, written as an array to
+ * the device file.  tag comes back in the completion.
+ */
+typedef struct {
+	u64		tag;
+	u32		id;		/* handle ID, 0 = use pathname */
+	u32		arg_count;
+	char		pathname[ACPI_PATHNAME_MAX];	/* relative if id set */
+	u64		args[DEV_ACPI_FAST_ARGS];	/* integer arguments */
+} dev_acpi_async_op_t;
+
+/*
+ * DEV_ACPI_ASYNC_REAP results, an array of completions at the start of
+ * the read buffer, result data follows as for DEV_ACPI_BATCH.
+ */
+typedef struct {
+	u64		tag;
+	u32		status;		/* 0 or errno value */
+	u32		offset;		/* of data from start of read buffer */
+	u32		length;		/* of data, 0 if none */
+	u32		reserved;
+	u64		latency;	/* ns, submit to completion */
+} dev_acpi_completion_t;
+
+typedef struct {
+	u32		count;
+	u32		return_size;
+} dev_acpi_async_t;
+
+/*
+ * Evaluation priority classes, see DEV_ACPI_SET_CLASS.  Per class
+ * counters from DEV_ACPI_GET_SCHED_STATS, times in ns.
+ */
+#define DEV_ACPI_CLASS_CRITICAL		0
+#define DEV_ACPI_CLASS_NORMAL		1	/* default */
+#define DEV_ACPI_CLASS_BACKGROUND	2
+#define DEV_ACPI_CLASSES		3
+
+typedef struct {
+	u32		eval_class;	/* DEV_ACPI_CLASS_* */
+	u32		reserved;
+} dev_acpi_class_t;
+
+typedef struct {
+	u64		evaluations;
+	u64		queued;		/* had to wait for a slot */
+	u64		wait_ns;	/* total waiting for a slot */
+	u64		wait_max_ns;
+	u64		exec_ns;	/* total in ACPI CA */
+	u64		exec_max_ns;
+} dev_acpi_class_stats_t;
+
+typedef struct {
+	dev_acpi_class_stats_t	classes[DEV_ACPI_CLASSES];
+} dev_acpi_sched_stats_t;
+
 #define DEV_ACPI_MAGIC 'A'
 
 /* Clear all state associated w/ device
@@ -77,8 +379,8 @@ typedef struct {
 
 /* Set Device/System Notify - install notify handler on device
  *  input - pathname
- *  output - none (notify events occur through read buffer as:
- *                 "%s,%08x", pathname, event)
+ *  output - none (notify events are queued and read as lines of:
+ *                 "%s,%08x\n", pathname, event)
  */
 #define DEV_ACPI_DEVICE_NOTIFY		_IOW(DEV_ACPI_MAGIC, 9, dev_acpi_t)
 #define DEV_ACPI_SYSTEM_NOTIFY		_IOW(DEV_ACPI_MAGIC, 10, dev_acpi_t)
@@ -96,4 +398,195 @@ typedef struct {
  */
 #define DEV_ACPI_BUS_GENERATE_EVENT	_IOW(DEV_ACPI_MAGIC, 13, dev_acpi_t)
 
+/* Get Next objects, binary version
+ *  input - pathname
+ *  output - data.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_node_t, one per child object
+ */
+#define DEV_ACPI_GET_NEXT_NODES		_IOWR(DEV_ACPI_MAGIC, 14, dev_acpi_t)
+
+/* Configure/query the notify event queue
+ *  input - config.depth = new queue depth (0 = don't change)
+ *          config.flags = DEV_ACPI_EVENT_BINARY/TEXT (0 = don't change)
+ *  output - config = current depth, queued events, overflow count and
+ *           mode
+ */
+#define DEV_ACPI_EVENT_CONFIG		_IOWR(DEV_ACPI_MAGIC, 15, \
+					      dev_acpi_event_config_t)
+
+/* Get module statistics
+ *  input - none
+ *  output - stats
+ */
+#define DEV_ACPI_GET_STATS		_IOR(DEV_ACPI_MAGIC, 16, dev_acpi_stats_t)
+
+/* Flush cached namespace lookups, eg. after a hotplug event the module
+ * didn't see
+ *  input - none
+ *  output - none
+ */
+#define DEV_ACPI_FLUSH_CACHES		_IO(DEV_ACPI_MAGIC, 17)
+
+/* Open a handle ID for an object, saves passing and resolving the
+ * pathname on every request
+ *  input - pathname
+ *  output - data.return_size = handle ID (per open file)
+ */
+#define DEV_ACPI_OPEN_HANDLE		_IOWR(DEV_ACPI_MAGIC, 18, dev_acpi_t)
+
+/* Close a handle ID
+ *  input - id.id
+ *  output - none
+ */
+#define DEV_ACPI_CLOSE_HANDLE		_IOW(DEV_ACPI_MAGIC, 19, dev_acpi_id_t)
+
+/* Issue a request on a handle ID instead of a pathname
+ *  input - id.cmd = DEV_ACPI_EXISTS, DEV_ACPI_GET_TYPE,
+ *                   DEV_ACPI_EVALUATE_OBJ, DEV_ACPI_EVALUATE_MMAP,
+ *                   DEV_ACPI_GET_NEXT,
+ *                   DEV_ACPI_GET_NEXT_NODES, DEV_ACPI_GET_PARENT,
+ *                   DEV_ACPI_GET_SUBTREE or one of the notify
+ *                   install/remove ioctls
+ *          id.id = handle ID
+ *          id.name = optional path relative to the ID (eg. "_STA")
+ *          plus any input of id.cmd other than the pathname
+ *  output - id.return_size and read buffer as for id.cmd
+ */
+#define DEV_ACPI_BY_ID			_IOWR(DEV_ACPI_MAGIC, 20, dev_acpi_id_t)
+
+/* Get every object below a path in one go
+ *  input - pathname
+ *  output - data.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_subtree_node_t in preorder
+ */
+#define DEV_ACPI_GET_SUBTREE		_IOWR(DEV_ACPI_MAGIC, 21, dev_acpi_t)
+
+/* Get Devices, with _UID and _STA
+ *  input - pathname = PNP _HID/_CID value to look for
+ *  output - data.return_size = length of read buffer
+ *           read buffer = lines of "%s,%s,%08x\n", pathname, _UID, _STA
+ */
+#define DEV_ACPI_GET_DEVICES_EXT	_IOWR(DEV_ACPI_MAGIC, 22, dev_acpi_t)
+
+/* Evaluate an object in a single call, no read or write buffer
+ *  input - fast.pathname, or fast.id and optional relative fast.pathname
+ *          fast.arg_count, fast.args = integer arguments
+ *  output - fast.type = result type (0 = none)
+ *           fast.value = integer result
+ *           fast.length, fast.data = string (terminated) or buffer result
+ *  Results that don't fit fail with E2BIG, use DEV_ACPI_EVALUATE_OBJ
+ */
+#define DEV_ACPI_EVAL_FAST		_IOWR(DEV_ACPI_MAGIC, 23, \
+					      dev_acpi_eval_fast_t)
+
+/* Evaluate an object, result in the area mmap'd on the device file
+ *  input - pathname, write buffer = arg list
+ *  output - data.return_size = length of result at the start of the area
+ *           (same layout as DEV_ACPI_EVALUATE_OBJ, offsets are from the
+ *           start of the area)
+ */
+#define DEV_ACPI_EVALUATE_MMAP		_IOWR(DEV_ACPI_MAGIC, 24, dev_acpi_t)
+
+/* Run a batch of operations in one call
+ *  input - batch.count, write buffer = array of dev_acpi_batch_op_t
+ *  output - batch.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_batch_result_t followed by
+ *           result data
+ */
+#define DEV_ACPI_BATCH			_IOWR(DEV_ACPI_MAGIC, 25, \
+					      dev_acpi_batch_t)
+
+/* Get the identification objects of a device in one go
+ *  input - pathname
+ *  output - data.return_size = length of read buffer
+ *           read buffer = dev_acpi_device_info_t
+ */
+#define DEV_ACPI_GET_DEVICE_INFO	_IOWR(DEV_ACPI_MAGIC, 26, dev_acpi_t)
+
+/* Install/remove notify handlers on a whole subtree
+ *  input - notify.pathname, notify.flags, notify.type (0 = devices)
+ *  output - notify.count/matched/done/exists/failed counters
+ *           notify.return_size = length of read buffer
+ *           read buffer = bitmap, bit n set if installing on the nth
+ *           DEV_ACPI_GET_SUBTREE record failed with EEXIST
+ */
+#define DEV_ACPI_NOTIFY_SUBTREE		_IOWR(DEV_ACPI_MAGIC, 27, \
+					      dev_acpi_notify_subtree_t)
+
+/* List the notify subscriptions of this file
+ *  input - none
+ *  output - data.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_notifier_t
+ */
+#define DEV_ACPI_GET_NOTIFIERS		_IOWR(DEV_ACPI_MAGIC, 28, dev_acpi_t)
+
+/* Set the event mask and coalescing window of notify subscriptions
+ *  input - filter.id (0 = every subscription of this file),
+ *          filter.mask, filter.window_ms
+ *  output - none
+ */
+#define DEV_ACPI_NOTIFY_FILTER		_IOW(DEV_ACPI_MAGIC, 29, \
+					      dev_acpi_notify_filter_t)
+
+/* Evaluate an object periodically from a kernel worker
+ *  input - sampler.pathname, or sampler.id and optional relative
+ *          sampler.pathname, sampler.interval_ms, sampler.flags
+ *  output - sampler.sample = sampler ID
+ *  With DEV_ACPI_SAMPLER_CHANGES, integer results that differ from the
+ *  last one are queued as DEV_ACPI_EVENT_VALUE_CHANGE events instead
+ */
+#define DEV_ACPI_SAMPLER_ADD		_IOWR(DEV_ACPI_MAGIC, 30, \
+					      dev_acpi_sampler_t)
+
+/* Stop sampling
+ *  input - sampler.sample = sampler ID
+ *  output - none
+ */
+#define DEV_ACPI_SAMPLER_REMOVE		_IOW(DEV_ACPI_MAGIC, 31, \
+					      dev_acpi_sampler_t)
+
+/* Drain the sample ring
+ *  input - none
+ *  output - data.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_sample_t
+ */
+#define DEV_ACPI_SAMPLER_READ		_IOWR(DEV_ACPI_MAGIC, 32, dev_acpi_t)
+
+/* Queue evaluations for the per open worker
+ *  input - async.count, write buffer = array of dev_acpi_async_op_t
+ *  output - async.count = number queued, the rest didn't fit
+ */
+#define DEV_ACPI_ASYNC_SUBMIT		_IOWR(DEV_ACPI_MAGIC, 33, \
+					      dev_acpi_async_t)
+
+/* Collect finished evaluations
+ *  input - async.count = most completions to return, 0 = all
+ *  output - async.count = number returned
+ *           async.return_size = length of read buffer
+ *           read buffer = array of dev_acpi_completion_t followed by
+ *                         result data
+ */
+#define DEV_ACPI_ASYNC_REAP		_IOWR(DEV_ACPI_MAGIC, 34, \
+					      dev_acpi_async_t)
+
+/* Give every thread using the fd its own read and write buffers
+ *  input - none
+ *  output - none
+ */
+#define DEV_ACPI_PER_THREAD		_IO(DEV_ACPI_MAGIC, 35)
+
+/* Set the priority class of evaluations made through this open
+ *  input - class.eval_class, CRITICAL needs CAP_SYS_NICE
+ *  output - none
+ */
+#define DEV_ACPI_SET_CLASS		_IOW(DEV_ACPI_MAGIC, 36, \
+					      dev_acpi_class_t)
+
+/* Get the evaluation scheduler counters
+ *  input - none
+ *  output - stats
+ */
+#define DEV_ACPI_GET_SCHED_STATS	_IOR(DEV_ACPI_MAGIC, 37, \
+					      dev_acpi_sched_stats_t)
+
 #endif /* __ACPI_SYSFS_H__ */
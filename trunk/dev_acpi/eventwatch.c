@@ -70,42 +70,13 @@ dump(char *msg, unsigned char *buf, int size)
 #define dump(msg, buf, size)
 #endif
 
-/*
- * get type
- */
-acpi_object_type
-get_type(int fd, char *path)
-{
-	dev_acpi_t		data;
-	union acpi_object	obj;
-
-	memset(&data, 0, sizeof(data));
-
-	strcpy(data.pathname, path);
-
-	if (ioctl(fd, DEV_ACPI_GET_TYPE, &data))
-		return -1;
-
-	if (data.return_size != sizeof(obj))
-		return -1;
-
-	if (read(fd, &obj, data.return_size) != data.return_size)
-		return -1;
-
-	dump("get_type", (unsigned char *)&obj, data.return_size);
-	if (obj.type != ACPI_TYPE_INTEGER)
-		return -1;
-
-	return (acpi_object_type)obj.integer.value;
-}
-
 /*
  * Do we consider this path a file or directory?
  */
 int
-is_dev(int fd, char *path)
+is_dev(acpi_object_type type)
 {
-	switch (get_type(fd, path)) {
+	switch (type) {
 		case ACPI_TYPE_DEVICE:
 		case ACPI_TYPE_PROCESSOR:
 		case ACPI_TYPE_THERMAL:
@@ -116,18 +87,73 @@ is_dev(int fd, char *path)
 	}
 }
 
+/*
+ * Print the path of GET_SUBTREE record i, parents first
+ */
 void
-set_notify(int fd, char *path)
+print_subtree_path(dev_acpi_subtree_node_t *nodes, u32 i)
 {
-	dev_acpi_t		data;
+	if (nodes[i].parent != DEV_ACPI_NO_PARENT) {
+		print_subtree_path(nodes, nodes[i].parent);
+		printf("%s%.4s", nodes[i].parent ? "." : "", nodes[i].name);
+	}
+}
 
-	memset(&data, 0 , sizeof(data));
-	strcpy(data.pathname, path);
-	if (ioctl(fd, DEV_ACPI_DEVICE_NOTIFY, &data) ||
-	    ioctl(fd, DEV_ACPI_SYSTEM_NOTIFY, &data))
-	    printf("Failed to set notifier on %s\n", path);
-	else
-	    printf("Set notifier on %s\n", path);
+/*
+ * Install device and system notifiers on every device in one go, list
+ * the devices someone else already has a handler on.
+ */
+void
+set_notify_all(int fd, int ev)
+{
+	dev_acpi_notify_subtree_t	notify;
+	dev_acpi_t			data;
+	dev_acpi_subtree_node_t		*nodes = NULL;
+	unsigned char			*bitmap;
+	u32				i;
+
+	memset(&notify, 0, sizeof(notify));
+	notify.flags = DEV_ACPI_NOTIFY_DEVICE | DEV_ACPI_NOTIFY_SYSTEM;
+
+	if (ioctl(ev, DEV_ACPI_NOTIFY_SUBTREE, &notify)) {
+		printf("Failed to set notifiers (%s)\n", strerror(errno));
+		return;
+	}
+
+	printf("Set %u notifiers on %u devices, %u in use, %u failed\n",
+	       notify.done, notify.matched, notify.exists, notify.failed);
+
+	if (!notify.exists)
+		return;
+
+	bitmap = malloc(notify.return_size);
+
+	if (!bitmap || read(ev, bitmap, notify.return_size) !=
+	               notify.return_size) {
+		free(bitmap);
+		return;
+	}
+
+	/* bits are indexed like the GET_SUBTREE records */
+	memset(&data, 0, sizeof(data));
+
+	if (!ioctl(fd, DEV_ACPI_GET_SUBTREE, &data) &&
+	    data.return_size / sizeof(*nodes) == notify.count)
+		nodes = malloc(data.return_size);
+
+	if (nodes && read(fd, nodes, data.return_size) == data.return_size) {
+		for (i = 0 ; i < notify.count ; i++) {
+			if (!(bitmap[i / 8] & (1 << (i % 8))))
+				continue;
+
+			printf("Notifier in use on \\");
+			print_subtree_path(nodes, i);
+			printf("\n");
+		}
+	}
+
+	free(nodes);
+	free(bitmap);
 }
 
 /*
@@ -514,77 +540,77 @@ get_parent(int fd, char *name, char **buf)
 }
 
 /*
- * Print out a "directory" and recurse through sub-dirs
+ * Get the objects below path along with their types, returns the
+ * number of dev_acpi_node_t records in *nodes or -1 on error
  */
-void
-print_level(int fd, int ev, char *path, int *entries, int level)
+int
+get_next_nodes(int fd, char *path, dev_acpi_node_t **nodes)
 {
 	dev_acpi_t	data;
-	int		i, cnt;
-	char		*buf, *tmp, *tmp2;
 
 	memset(&data, 0, sizeof(data));
-	
+	*nodes = NULL;
+
 	if (path)
 		strcpy(data.pathname, path);
 
-	if (ioctl(fd, DEV_ACPI_GET_NEXT, &data)) {
-		printf("GET_NEXT failed at %s (%s)\n", path, strerror(errno));
-		return;
-	}
+	if (ioctl(fd, DEV_ACPI_GET_NEXT_NODES, &data))
+		return -1;
 
-	buf = malloc(data.return_size);
+	if (data.return_size == 0)
+		return 0;
 
-	if (!buf) {
-		printf("failed to malloc get_next buffer at %s\n", path);
-		return;
-	}
+	*nodes = malloc(data.return_size);
 
-	if (data.return_size == 0)
-		return;
+	if (!*nodes)
+		return -1;
 
-	if (read(fd, buf, data.return_size) != data.return_size) {
-		printf("short read at %s\n", path);
-		return;
+	if (read(fd, *nodes, data.return_size) != data.return_size) {
+		free(*nodes);
+		*nodes = NULL;
+		return -1;
 	}
 
-	dump("GET_NEXT", buf, data.return_size);
-	// printf("BUFFER: %s\n", buf);
+	dump("GET_NEXT_NODES", (unsigned char *)*nodes, data.return_size);
+	return data.return_size / sizeof(dev_acpi_node_t);
+}
+
+/*
+ * Print out a "directory" and recurse through sub-dirs
+ */
+void
+print_level(int fd, int ev, char *path, int *entries, int level)
+{
+	dev_acpi_node_t	*nodes;
+	int		i, cnt, type;
+
+	cnt = get_next_nodes(fd, path, &nodes);
 
-	tmp = buf;
-	for (cnt = 0; (tmp = strchr(tmp, '\n')) != NULL ; cnt++)
-		tmp++;
+	if (cnt < 0) {
+		printf("GET_NEXT_NODES failed at %s (%s)\n", path,
+		       strerror(errno));
+		return;
+	}
 
 	entries[level] = cnt;
 	
-	tmp = buf;
 	for (i = 0 ; i < cnt ; i++) {
 		unsigned long len;
-		char *new_path, *cur_obj, hid[8];
+		char *new_path, cur_obj[5], hid[8];
 
-		tmp2 = strchr(tmp, '\n');
+		memset(cur_obj, 0, sizeof(cur_obj));
+		memcpy(cur_obj, nodes[i].name, sizeof(nodes[i].name));
 
-		len = (unsigned long)tmp2 - (unsigned long)tmp;
-		len++;
+		type = nodes[i].type;
 
-		cur_obj = malloc(len);
-
-		if (!cur_obj) {
-			free(buf);
-			return;
-		}
-		memset(cur_obj, 0, len);
-		strncpy(cur_obj, tmp, len - 1);
-
-		tmp = tmp2 + 1;
-		
+		len = sizeof(cur_obj);
 		if (path)
 			len += strlen(path) + 1;
 
 		new_path = malloc(len);
 
 		if (!new_path) {
-			free(buf);
+			free(nodes);
 			return;
 		}
 		memset(new_path, 0, len);
@@ -595,28 +621,29 @@ print_level(int fd, int ev, char *path, int *entries, int level)
 		}
 		strcat(new_path, cur_obj);
 		
-		if (is_dev(fd, new_path)) {
-			set_notify(ev, new_path);
+		if (is_dev(type)) {
 			indent(entries, level);
-			printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
-			print_level(fd, ev, new_path, entries, level + 1);
+			printf("%s [%d]\n", cur_obj, type);
+			if (nodes[i].children)
+				print_level(fd, ev, new_path, entries,
+				            level + 1);
 		} else {
 			indent(entries, level);
 			if (!strcmp(cur_obj, "_HID") ||
 			    !strcmp(cur_obj, "_CID")) {
 				get_hid(fd, new_path, hid);
-				printf("%s (%s) [%d]\n", cur_obj, hid, get_type(fd, new_path));
+				printf("%s (%s) [%d]\n", cur_obj, hid, type);
 			} else if (!strcmp(cur_obj, "_STR") ||
-			           get_type(fd, new_path) == ACPI_TYPE_STRING) {
+			           type == ACPI_TYPE_STRING) {
 				char *str = NULL;
 				get_string(fd, new_path, &str);
-				printf("%s (%s) [%d]\n", cur_obj, str, get_type(fd, new_path));
+				printf("%s (%s) [%d]\n", cur_obj, str, type);
 				free(str);
 			} else if (!strcmp(cur_obj, "_STA") ||
-			           get_type(fd, new_path)==ACPI_TYPE_INTEGER) {
+			           type == ACPI_TYPE_INTEGER) {
 				printf("%s (0x%llx) [%d]\n", cur_obj,
 				       get_integer(fd, new_path),
-				       get_type(fd, new_path));
+				       type);
 			} else if (!strcmp(cur_obj, "_CRS") ||
 			           !strcmp(cur_obj, "_PRT") ||
 			           !strcmp(cur_obj, "_MAT")) {
@@ -626,9 +653,9 @@ print_level(int fd, int ev, char *path, int *entries, int level)
 				len = dump_raw(fd, new_path, &buf);
 
 				if (len <= 0)
-					printf("%s (empty/failed) [%d]\n", cur_obj, get_type(fd, new_path));
+					printf("%s (empty/failed) [%d]\n", cur_obj, type);
 				else {
-					printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
+					printf("%s [%d]\n", cur_obj, type);
 
 					indent(entries, level);
 					printf("\t%04x: ", 0);
@@ -644,15 +671,43 @@ print_level(int fd, int ev, char *path, int *entries, int level)
 					printf("\n");
 				}
 			} else
-				printf("%s [%d]\n", cur_obj, get_type(fd, new_path));
+				printf("%s [%d]\n", cur_obj, type);
 		}
 
 		entries[level]--;
 		free(new_path);
-		free(cur_obj);
 	}
+	free(nodes);
+
+
+}
+
+/*
+ * Subscriptions of the event fd, to name the devices in binary events
+ */
+int
+get_notifiers(int ev, dev_acpi_notifier_t **notifiers)
+{
+	dev_acpi_t	data;
 
+	*notifiers = NULL;
+	memset(&data, 0, sizeof(data));
+
+	if (ioctl(ev, DEV_ACPI_GET_NOTIFIERS, &data) || !data.return_size)
+		return 0;
+
+	*notifiers = malloc(data.return_size);
+
+	if (!*notifiers)
+		return 0;
+
+	if (read(ev, *notifiers, data.return_size) != data.return_size) {
+		free(*notifiers);
+		*notifiers = NULL;
+		return 0;
+	}
 
+	return data.return_size / sizeof(dev_acpi_notifier_t);
 }
 
 /*
@@ -694,18 +749,61 @@ main (int argc, char **argv)
 #endif
 //	generate_event(fd, "\\_SB_.C139", 0x80, 0x4);
 	print_system_info(fd);
+	set_notify_all(fd, ev);
 	printf("\\\\\n");
 	print_level(fd, ev, NULL, entries, 1);	
 #if 1
 	{
-		dev_acpi_t	data;
-		char		event[ACPI_PATHNAME_MAX];
+		dev_acpi_event_config_t	config;
+		dev_acpi_notifier_t	*notifiers;
+		dev_acpi_event_t	events[64];
+		u64			start = 0;
+		char			*name;
+		int			size, count, i, j;
+
+		count = get_notifiers(ev, &notifiers);
+
+		memset(&config, 0, sizeof(config));
+		config.flags = DEV_ACPI_EVENT_BINARY;
+
+		if (ioctl(ev, DEV_ACPI_EVENT_CONFIG, &config)) {
+			printf("Failed to set binary events (%s)\n",
+			       strerror(errno));
+			return 1;
+		}
 
+		/* each read returns as many queued events as fit */
 		while (1) {
-			memset(event, 0, ACPI_PATHNAME_MAX);
-			read(ev, event, ACPI_PATHNAME_MAX);
-			printf("Event: %s\n", event);
-			ioctl(ev, DEV_ACPI_CLEAR, &data);
+			size = read(ev, events, sizeof(events));
+			if (size < 0 && (errno == EINTR || errno == EAGAIN))
+				continue;
+			if (size < 0) {
+				printf("Event read failed (%s)\n",
+				       strerror(errno));
+				break;
+			}
+			if (!size)
+				break;
+
+			for (i = 0 ; i < size / sizeof(events[0]) ; i++) {
+				if (!start)
+					start = events[i].timestamp;
+
+				name = "????";
+				for (j = 0 ; j < count ; j++)
+					if (notifiers[j].id == events[i].id)
+						name = notifiers[j].pathname;
+
+				printf("Event: %s,%08x +%llu.%06llums", name,
+				       events[i].event,
+				       (unsigned long long)
+				       (events[i].timestamp - start) / 1000000,
+				       (unsigned long long)
+				       (events[i].timestamp - start) % 1000000);
+				if (events[i].count > 1)
+					printf(" (x%u)", events[i].count);
+				printf("\n");
+			}
 		}
 	}
 #endif
@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2004 Hewlett Packard, LLC
+ *      Alex Williamson <alex.williamson@hp.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+/*
+ * Benchmark for the list results of DEV_ACPI_GET_NEXT, GET_OBJECTS and
+ * GET_DEVICES.  By default it runs the old and new ways of building the
+ * list over synthetic paths, with the same allocation pattern the module
+ * uses (malloc standing in for kmalloc).  With -p/-o/-d it times the
+ * ioctl itself against the loaded module instead.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+
+#define ACPI_USE_SYSTEM_CLIBRARY
+#define ACPI_USE_STANDARD_HEADERS
+#define DEFINE_ALTERNATE_TYPES
+
+#include <acpi/acconfig.h>
+#include <acpi/platform/acenv.h>
+
+typedef COMPILER_DEPENDENT_INT64       s64;
+
+#include <acpi/actypes.h>
+
+#define ACPI_MAX_STRING 80
+#define ACPI_PATHNAME_MAX 256
+#include "dev_acpi.h"
+
+#define DEVICE "/dev/acpi"
+
+#define RESULT_BUF_MIN	256
+
+static double
+now_ms(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/*
+ * The way the module used to do it: a new buffer per entry with the
+ * whole previous result sprintf'd into it.
+ */
+static char *
+build_old(int count, size_t *length)
+{
+	char	*pointer, *new_buf, name[ACPI_PATHNAME_MAX];
+	size_t	len = 1, new_size;
+	int	i;
+
+	pointer = calloc(1, 1);
+	if (!pointer)
+		return NULL;
+
+	for (i = 0 ; i < count ; i++) {
+		sprintf(name, "\\_SB_.PCI0.N%03X", i);
+
+		/* the terminator is replaced with a line feed */
+		new_size = len + strlen(name) + 1;
+		new_buf = malloc(new_size);
+
+		if (!new_buf) {
+			free(pointer);
+			return NULL;
+		}
+
+		memset(new_buf, 0, new_size);
+		sprintf(new_buf, "%s%s\n", pointer, name);
+
+		free(pointer);
+		pointer = new_buf;
+		len = new_size;
+	}
+
+	*length = len;
+	return pointer;
+}
+
+/* result_buf_t: append into an allocation that doubles when it fills */
+static char *
+build_new(int count, size_t *length)
+{
+	char	*pointer = NULL, *new_buf, name[ACPI_PATHNAME_MAX];
+	size_t	len = 0, size = 0, new_size, name_len;
+	int	i;
+
+	for (i = 0 ; i <= count ; i++) {
+		if (i < count) {
+			sprintf(name, "\\_SB_.PCI0.N%03X\n", i);
+			name_len = strlen(name);
+		} else
+			name_len = 1;	/* terminator */
+
+		if (len + name_len > size) {
+			new_size = size ? size : RESULT_BUF_MIN;
+			while (new_size < len + name_len)
+				new_size <<= 1;
+
+			new_buf = malloc(new_size);
+			if (!new_buf) {
+				free(pointer);
+				return NULL;
+			}
+
+			if (pointer) {
+				memcpy(new_buf, pointer, len);
+				free(pointer);
+			}
+
+			pointer = new_buf;
+			size = new_size;
+		}
+
+		if (i < count)
+			memcpy(pointer + len, name, name_len);
+		else
+			pointer[len] = '\0';
+		len += name_len;
+	}
+
+	*length = len;
+	return pointer;
+}
+
+static int
+model(int count)
+{
+	char	*old_buf, *new_buf;
+	size_t	old_len, new_len;
+	double	start, old_ms, new_ms;
+
+	start = now_ms();
+	old_buf = build_old(count, &old_len);
+	old_ms = now_ms() - start;
+
+	start = now_ms();
+	new_buf = build_new(count, &new_len);
+	new_ms = now_ms() - start;
+
+	if (!old_buf || !new_buf) {
+		printf("%s() ERROR: out of memory\n", __FUNCTION__);
+		free(old_buf);
+		free(new_buf);
+		return 1;
+	}
+
+	if (old_len != new_len || memcmp(old_buf, new_buf, old_len)) {
+		printf("%s() ERROR: results differ\n", __FUNCTION__);
+		free(old_buf);
+		free(new_buf);
+		return 1;
+	}
+
+	printf("%d entries (%lu bytes): old %.1f ms, new %.1f ms\n",
+	       count, (unsigned long)new_len, old_ms, new_ms);
+
+	free(old_buf);
+	free(new_buf);
+	return 0;
+}
+
+/* Time iterations of one list ioctl, reading the result each time */
+static int
+live(int cmd, char *arg, int iterations)
+{
+	dev_acpi_t	data;
+	char		*buf;
+	double		start, total = 0, max = 0, ms;
+	int		fd, i;
+	u32		size = 0;
+
+	fd = open(DEVICE, O_RDWR);
+
+	if (fd < 0) {
+		printf("%s() ERROR: opening %s: %s\n", __FUNCTION__, DEVICE,
+		       strerror(errno));
+		return 1;
+	}
+
+	for (i = 0 ; i < iterations ; i++) {
+		memset(&data, 0, sizeof(data));
+		strncpy(data.pathname, arg, sizeof(data.pathname) - 1);
+
+		start = now_ms();
+
+		if (ioctl(fd, cmd, &data)) {
+			printf("%s() ERROR: ioctl failed: %s\n", __FUNCTION__,
+			       strerror(errno));
+			close(fd);
+			return 1;
+		}
+
+		size = data.return_size;
+
+		if (size) {
+			buf = malloc(size);
+			if (!buf) {
+				printf("%s() ERROR: malloc failed\n",
+				       __FUNCTION__);
+				close(fd);
+				return 1;
+			}
+
+			if (pread(fd, buf, size, 0) != size) {
+				printf("%s() ERROR: read() unexpected return\n",
+				       __FUNCTION__);
+				free(buf);
+				close(fd);
+				return 1;
+			}
+			free(buf);
+		}
+
+		ms = now_ms() - start;
+		total += ms;
+		if (ms > max)
+			max = ms;
+	}
+
+	printf("%s: %d calls, %u bytes, avg %.3f ms, max %.3f ms\n", arg,
+	       iterations, size, total / iterations, max);
+
+	close(fd);
+	return 0;
+}
+
+static void
+usage(char *name)
+{
+	printf("usage: %s [-n entries]\n", name);
+	printf("       %s [-i iterations] -p path | -o name | -d hid\n", name);
+	printf("  -n  build old and new style lists of this many entries\n");
+	printf("      (10000 and 20000 without -n)\n");
+	printf("  -p  time DEV_ACPI_GET_NEXT on path\n");
+	printf("  -o  time DEV_ACPI_GET_OBJECTS for name\n");
+	printf("  -d  time DEV_ACPI_GET_DEVICES for hid\n");
+}
+
+int
+main (int argc, char **argv)
+{
+	char	*arg = NULL;
+	int	i, count = 0, iterations = 100, cmd = 0;
+
+	for (i = 1 ; i < argc ; i++) {
+		if (i + 1 == argc) {
+			usage(argv[0]);
+			return 1;
+		}
+
+		if (!strcmp(argv[i], "-n"))
+			count = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-i"))
+			iterations = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "-p")) {
+			cmd = DEV_ACPI_GET_NEXT;
+			arg = argv[++i];
+		} else if (!strcmp(argv[i], "-o")) {
+			cmd = DEV_ACPI_GET_OBJECTS;
+			arg = argv[++i];
+		} else if (!strcmp(argv[i], "-d")) {
+			cmd = DEV_ACPI_GET_DEVICES;
+			arg = argv[++i];
+		} else {
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (cmd)
+		return live(cmd, arg, iterations > 0 ? iterations : 1);
+
+	if (count > 0)
+		return model(count);
+
+	return model(10000) || model(20000);
+}